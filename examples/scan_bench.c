@@ -0,0 +1,189 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/scan.h"
+
+#define ROUNDS 2000
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return _M_cast(double, ts.tv_sec) * 1e9 + _M_cast(double, ts.tv_nsec);
+}
+
+// memchr-based baselines
+static ssize_t base_find_crlf(box_t data) {
+  const uint8_t* p = data.ptr;
+  const uint8_t* end = data.ptr + data.size;
+
+  while (p < end) {
+    p = _M_cast(const uint8_t*, memchr(p, '\r', _M_cast(size_t, end - p)));
+    if (p == NULL || p + 1 >= end) return -1;
+    if (p[1] == '\n') return p - data.ptr;
+    p++;
+  }
+
+  return -1;
+}
+
+static size_t base_count_lines(box_t data) {
+  const uint8_t* p = data.ptr;
+  const uint8_t* end = data.ptr + data.size;
+  size_t n = 0;
+
+  while ((p = memchr(p, '\n', _M_cast(size_t, end - p))) != NULL) {
+    n++;
+    p++;
+  }
+
+  return n;
+}
+
+static void report(const char* name, double base_ns, double scan_ns,
+                   size_t bytes) {
+  double base_gbs = _M_cast(double, bytes) * ROUNDS / base_ns;
+  double scan_gbs = _M_cast(double, bytes) * ROUNDS / scan_ns;
+  printf("%-12s  memchr %7.2f GB/s  scan %7.2f GB/s  (x%.2f)\n", name,
+         base_gbs, scan_gbs, scan_gbs / base_gbs);
+}
+
+// Edge cases the benchmark inputs below do not reach: empty and NULL views
+// and inputs shorter than one vector.
+static int32_t check_edge_cases(void) {
+  box_t null = box__ctor(NULL, 0);
+  const char* line = "Host: x\r\n";
+  box_t tail = box__ctor(_M_cast(uint8_t*, line), strlen(line));
+
+  if (scan__find(null, '\n') != -1) return -1;
+  if (scan__find_crlf(null) != -1) return -1;
+  if (scan__count_lines(null) != 0) return -1;
+  if (!scan__ieq(null, null)) return -1;
+  if (!scan__token_ieq(null, "")) return -1;
+  if (scan__token_ieq(null, "host")) return -1;
+
+  box_t rest = null;
+  if (scan__split(&rest, ':').ptr != NULL) return -1;
+
+  if (scan__find(tail, ':') != 4) return -1;
+  if (scan__find_crlf(tail) != 7) return -1;
+  if (scan__find_crlf(box__ctor(tail.ptr, 8)) != -1) return -1;
+  if (scan__count_lines(tail) != 1) return -1;
+
+  rest = tail;
+  box_t name = scan__split(&rest, ':');
+  if (!scan__token_ieq(name, "HOST") || scan__token_ieq(name, "hosts")) {
+    return -1;
+  }
+  if (scan__token_ieq(name, "hist")) return -1;
+
+  box_t value = scan__split_line(&rest);
+  if (!scan__token_ieq(value, " X")) return -1;
+
+  // The trailing "\r\n" leaves one empty line before the end
+  box_t last = scan__split_line(&rest);
+  if (last.ptr == NULL || last.size != 0) return -1;
+  if (scan__split_line(&rest).ptr != NULL) return -1;
+
+  return 0;
+}
+
+int32_t main(void) {
+  if (check_edge_cases() != 0) {
+    fprintf(stderr, "scan: edge case check failed\n");
+    return EXIT_FAILURE;
+  }
+
+  const size_t size = KiB(64);
+  uint8_t* mem = _M_cast(uint8_t*, malloc(size));
+
+  // Header-like payload: 60 byte lines terminated by CRLF, "X-Token" at the end
+  for (size_t i = 0; i < size; i++) mem[i] = 'a' + (i % 26);
+  for (size_t i = 60; i + 1 < size; i += 62) {
+    mem[i] = '\r';
+    mem[i + 1] = '\n';
+  }
+  memcpy(mem + size - 7, "X-TOKEN", 7);
+
+  box_t data = box__ctor(mem, size);
+  box_t tail = box__ctor(mem + size - 7, 7);
+  volatile size_t sink = 0;
+  double t0, t1, t2;
+
+  // find: the delimiter sits 8 bytes before the end, so almost the whole
+  // buffer is scanned
+  mem[size - 8] = '|';
+  t0 = now_ns();
+  for (int32_t r = 0; r < ROUNDS; r++) sink += memchr(mem, '|', size) != NULL;
+  t1 = now_ns();
+  for (int32_t r = 0; r < ROUNDS; r++) sink += scan__find(data, '|');
+  t2 = now_ns();
+  if (scan__find(data, '|') != _M_cast(ssize_t, size - 8)) return EXIT_FAILURE;
+  report("find", t1 - t0, t2 - t1, size);
+
+  // find_crlf: only '\r' without '\n' before the end
+  uint8_t* last_cr = mem + size - 8;
+  for (size_t i = 60; i + 1 < size; i += 62) mem[i + 1] = '-';
+  *last_cr = '\r';
+  *(last_cr + 1) = '\n';
+  t0 = now_ns();
+  for (int32_t r = 0; r < ROUNDS; r++) sink += base_find_crlf(data);
+  t1 = now_ns();
+  for (int32_t r = 0; r < ROUNDS; r++) sink += scan__find_crlf(data);
+  t2 = now_ns();
+  if (scan__find_crlf(data) != base_find_crlf(data)) return EXIT_FAILURE;
+  report("find_crlf", t1 - t0, t2 - t1, size);
+
+  // count_lines
+  for (size_t i = 60; i + 1 < size; i += 62) mem[i + 1] = '\n';
+  t0 = now_ns();
+  for (int32_t r = 0; r < ROUNDS; r++) sink += base_count_lines(data);
+  t1 = now_ns();
+  for (int32_t r = 0; r < ROUNDS; r++) sink += scan__count_lines(data);
+  t2 = now_ns();
+  if (scan__count_lines(data) != base_count_lines(data)) return EXIT_FAILURE;
+  report("count_lines", t1 - t0, t2 - t1, size);
+
+  // token_ieq
+  memcpy(mem + size - 7, "X-TOKEN", 7);
+  const char* volatile token = "x-token";  // keep calls from being hoisted
+  t0 = now_ns();
+  for (int32_t r = 0; r < ROUNDS * 1000; r++)
+    sink += strncasecmp(_M_cast(char*, tail.ptr), token, tail.size) == 0;
+  t1 = now_ns();
+  for (int32_t r = 0; r < ROUNDS * 1000; r++)
+    sink += scan__token_ieq(tail, token);
+  t2 = now_ns();
+  if (!scan__token_ieq(tail, "x-token")) return EXIT_FAILURE;
+  printf("%-12s  strncasecmp %6.2f ns  scan %6.2f ns\n", "token_ieq",
+         (t1 - t0) / (ROUNDS * 1000), (t2 - t1) / (ROUNDS * 1000));
+
+  free(mem);
+  return sink == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,193 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+// Broadcast server showing cross-thread sends through an io_mailbox_t.
+//
+// usage: tcp_broadcast_server [port] [producers]
+//
+// The main thread is the I/O thread: it owns all connections and polls the
+// listening socket, the connections and the mailbox fd. Producer threads
+// never touch a socket, they post a broadcast closure to the mailbox, which
+// the I/O thread runs in its next batch. No mutex is needed around send.
+// Sends never block the I/O thread: a slow client gets a backlog that is
+// flushed on POLLOUT, and is dropped once that backlog grows too large.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/mailbox.h"
+#include "micro-sockets/tcp.h"
+
+#define MAX_CONNS 1024
+#define MAX_BACKLOG KiB(256)
+
+typedef struct io_state_t io_state_t;
+
+struct io_state_t {
+  io_mailbox_t* mailbox;
+  io_conn_id_t ids[MAX_CONNS];
+  size_t n;
+};
+
+typedef struct broadcast_t broadcast_t;
+
+struct broadcast_t {
+  io_task_t task;  // must be first
+  io_state_t* io;
+  int32_t len;
+  char msg[64];
+};
+
+// Runs on the I/O thread
+static void broadcast__run(io_task_t* task) {
+  broadcast_t* self = _M_cast(broadcast_t*, task);
+  box_t data = box__ctor(_M_cast(uint8_t*, self->msg), self->len);
+
+  // Failed sends are noticed by the poll loop, which drops the client
+  for (size_t i = 0; i < self->io->n; i++) {
+    io_mailbox__send(self->io->mailbox, self->io->ids[i], data);
+  }
+
+  free(self);
+}
+
+typedef struct producer_t producer_t;
+
+struct producer_t {
+  io_state_t* io;
+  int32_t id;
+};
+
+static void* producer(void* arg) {
+  producer_t* self = _M_cast(producer_t*, arg);
+  struct timespec delay = {.tv_sec = 0, .tv_nsec = 250000000};
+
+  for (uint64_t seq = 0;; seq++) {
+    nanosleep(&delay, NULL);
+
+    broadcast_t* b = _M_cast(broadcast_t*, malloc(sizeof(broadcast_t)));
+    b->io = self->io;
+    b->len = snprintf(b->msg, sizeof(b->msg), "producer %d: tick %llu\n",
+                      self->id, _M_cast(unsigned long long, seq));
+    io_mailbox__post(self->io->mailbox, &b->task, broadcast__run);
+  }
+
+  return NULL;
+}
+
+int32_t main(int32_t argc, char** argv) {
+  uint16_t port = argc > 1 ? _M_cast(uint16_t, atoi(argv[1])) : 4040;
+  int32_t n_producers = argc > 2 ? atoi(argv[2]) : 4;
+
+  tcp_server_t* server = tcp_server__new(AF_INET, "0.0.0.0", port);
+  if (server == NULL) {
+    fprintf(stderr, "[broadcast] could not bind port %u\n", port);
+    return EXIT_FAILURE;
+  }
+
+  // Broadcasting to a client that already reset must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  tcp_server__attach_buf(server, buf__new(KiB(4)));
+  tcp_server__listen(server, 128);
+
+  static io_state_t io;
+  io.mailbox = io_mailbox__new();
+  io.n = 0;
+
+  producer_t* producers = calloc(n_producers, sizeof(producer_t));
+  for (int32_t i = 0; i < n_producers; i++) {
+    pthread_t thread;
+    producers[i] = (producer_t){.io = &io, .id = i};
+    pthread_create(&thread, NULL, producer, &producers[i]);
+    pthread_detach(thread);
+  }
+
+  // fds[0] listener, fds[1] mailbox, fds[2 + i] connection i
+  struct pollfd fds[MAX_CONNS + 2];
+  fds[0] = (struct pollfd){.fd = server->sock, .events = POLLIN};
+  fds[1] = (struct pollfd){.fd = io_mailbox__fd(io.mailbox), .events = POLLIN};
+
+  for (;;) {
+    for (size_t i = 0; i < io.n; i++) {
+      bool backlog = io_mailbox__backlog(io.mailbox, io.ids[i]) > 0;
+      fds[2 + i].events = POLLIN | (backlog ? POLLOUT : 0);
+    }
+
+    if (poll(fds, io.n + 2, -1) < 0) break;
+
+    // Anything a client sends is ignored. EOF, an error or a client that
+    // does not keep up drops it.
+    for (size_t i = io.n; i-- > 0;) {
+      io_conn_id_t id = io.ids[i];
+      int16_t revents = fds[2 + i].revents;
+      bool drop = false;
+
+      if (revents & POLLOUT) drop = io_mailbox__flush(io.mailbox, id) != 0;
+      if (!drop && (revents & (POLLIN | POLLHUP | POLLERR))) {
+        box_t data = tcp_server__recv(server, io_mailbox__conn(io.mailbox, id));
+        drop = data.size == 0;
+      }
+      if (!drop && io_mailbox__backlog(io.mailbox, id) <= MAX_BACKLOG) {
+        continue;
+      }
+
+      tcp_connection_t conn = *io_mailbox__conn(io.mailbox, id);
+      io_mailbox__unregister(io.mailbox, id);
+      tcp_connection__close(&conn);
+      io.n--;
+      io.ids[i] = io.ids[io.n];
+      fds[2 + i] = fds[2 + io.n];
+    }
+
+    if (fds[1].revents & POLLIN) io_mailbox__drain(io.mailbox, 64);
+
+    if (fds[0].revents & POLLIN) {
+      tcp_connection_t conn = tcp_server__accept(server);
+      if (conn.fd < 0) continue;
+
+      io_conn_id_t id =
+          io.n < MAX_CONNS ? io_mailbox__register(io.mailbox, conn) : 0;
+      if (id == 0) {
+        tcp_connection__close(&conn);
+        continue;
+      }
+
+      io.ids[io.n] = id;
+      fds[2 + io.n] = (struct pollfd){.fd = conn.fd, .events = POLLIN};
+      io.n++;
+    }
+  }
+
+  io_mailbox__free(io.mailbox);
+  tcp_server__shutdown(server);
+  tcp_server__free(server);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+// Bulk ingest over zero-copy receive (micro-sockets/zerocopy.h).
+//
+// usage: tcp_bulk_ingest serve [port] [copy]
+//        tcp_bulk_ingest send <addr> [port] [MiB]
+//
+// `serve` accepts one upload at a time, consumes it with tcp_zc_recv_t and
+// prints throughput and how many bytes were mapped instead of copied. Pass
+// `copy` to compare against plain tcp_server__recv. `send` uploads the given
+// amount of data. Zero-copy only kicks in for page aligned payload, which
+// typically requires an MTU of 4096 + headers on a real NIC; over loopback
+// most bytes take the copy fallback.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/tcp.h"
+#include "micro-sockets/zerocopy.h"
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return _M_cast(double, ts.tv_sec) + _M_cast(double, ts.tv_nsec) / 1e9;
+}
+
+typedef struct checksum_t checksum_t;
+
+// Fletcher style checksum over 8 byte words of the whole stream. It does not
+// depend on how the stream was split into chunks, so both modes print the
+// same value for the same upload.
+struct checksum_t {
+  uint64_t s1;
+  uint64_t s2;
+  uint8_t word[8];  // bytes of a word split across chunks
+  size_t word_len;
+};
+
+static void checksum__word(checksum_t* self, const uint8_t* p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  self->s1 += w;
+  self->s2 += self->s1;
+}
+
+// Stand-in for real processing, touches every byte once
+static void consume(checksum_t* self, box_t data) {
+  size_t i = 0;
+
+  if (self->word_len > 0) {
+    while (self->word_len < 8 && i < data.size) {
+      self->word[self->word_len++] = data.ptr[i++];
+    }
+    if (self->word_len < 8) return;
+
+    checksum__word(self, self->word);
+    self->word_len = 0;
+  }
+
+  for (; i + 8 <= data.size; i += 8) checksum__word(self, data.ptr + i);
+  while (i < data.size) self->word[self->word_len++] = data.ptr[i++];
+}
+
+static uint64_t checksum__final(checksum_t* self) {
+  if (self->word_len > 0) {
+    memset(self->word + self->word_len, 0, 8 - self->word_len);
+    checksum__word(self, self->word);
+    self->word_len = 0;
+  }
+
+  return self->s1 ^ self->s2;
+}
+
+static int32_t serve(uint16_t port, int32_t zerocopy) {
+  tcp_server_t* server = tcp_server__new(AF_INET, "0.0.0.0", port);
+  if (server == NULL) {
+    fprintf(stderr, "[ingest] could not bind port %u\n", port);
+    return EXIT_FAILURE;
+  }
+
+  tcp_server__attach_buf(server, buf__new(KiB(256)));
+  tcp_server__listen(server, 16);
+  printf("[ingest] listening on 0.0.0.0:%u (%s)\n", port,
+         zerocopy ? "zero-copy" : "copy");
+  fflush(stdout);
+
+  for (;;) {
+    tcp_connection_t conn = tcp_server__accept(server);
+    if (conn.fd < 0) continue;
+
+    uint64_t total = 0;
+    checksum_t sum = {0};
+    double start = now_s();
+
+    if (zerocopy) {
+      tcp_zc_recv_t* zc = tcp_connection__zc_recv(&conn, MiB(2),
+                                                  buf__new(KiB(256)));
+      box_t data;
+
+      while ((data = tcp_zc_recv__recv(zc)).size > 0) {
+        consume(&sum, data);
+        total += data.size;
+        tcp_zc_recv__release(zc, data);
+      }
+
+      printf("[ingest] mapped %zu bytes, copied %zu bytes\n",
+             zc->mapped_bytes, zc->copied_bytes);
+      tcp_zc_recv__free(zc);
+    } else {
+      box_t data;
+
+      while ((data = tcp_server__recv(server, &conn)).size > 0) {
+        consume(&sum, data);
+        total += data.size;
+      }
+    }
+
+    double elapsed = now_s() - start;
+    printf("[ingest] %.1f MiB in %.2fs, %.2f GiB/s (checksum %llu)\n",
+           _M_cast(double, total) / MiB(1), elapsed,
+           _M_cast(double, total) / elapsed / (1024.0 * 1024.0 * 1024.0),
+           _M_cast(unsigned long long, checksum__final(&sum)));
+    fflush(stdout);
+
+    tcp_connection__close(&conn);
+  }
+
+  tcp_server__shutdown(server);
+  tcp_server__free(server);
+
+  return EXIT_SUCCESS;
+}
+
+static int32_t send_bulk(const char* addr, uint16_t port, size_t mib) {
+  tcp_client_t* client = tcp_client__new(AF_INET, addr, port);
+  if (client == NULL || tcp_client__connect(client) != 0) {
+    fprintf(stderr, "[ingest] could not connect to %s:%u\n", addr, port);
+    return EXIT_FAILURE;
+  }
+
+  // Not a constant fill, so the checksum also catches reordered data
+  uint8_t* chunk = _M_cast(uint8_t*, malloc(MiB(1)));
+  for (size_t i = 0; i < MiB(1); i++) {
+    chunk[i] = _M_cast(uint8_t, i * 131 + (i >> 12));
+  }
+
+  for (size_t i = 0; i < mib; i++) {
+    box_t data = box__ctor(chunk, MiB(1));
+
+    while (data.size > 0) {
+      ssize_t n = tcp_client__send(client, data);
+      if (n <= 0) return EXIT_FAILURE;
+
+      data = box__ctor(data.ptr + n, data.size - _M_cast(size_t, n));
+    }
+  }
+
+  free(chunk);
+  tcp_client__close(client);
+  tcp_client__free(client);
+
+  return EXIT_SUCCESS;
+}
+
+int32_t main(int32_t argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+    uint16_t port = argc > 2 ? _M_cast(uint16_t, atoi(argv[2])) : 4040;
+    int32_t zerocopy = !(argc > 3 && strcmp(argv[3], "copy") == 0);
+
+    return serve(port, zerocopy);
+  }
+
+  if (argc > 2 && strcmp(argv[1], "send") == 0) {
+    uint16_t port = argc > 3 ? _M_cast(uint16_t, atoi(argv[3])) : 4040;
+    size_t mib = argc > 4 ? strtoull(argv[4], NULL, 10) : 1024;
+
+    return send_bulk(argv[2], port, mib);
+  }
+
+  fprintf(stderr,
+          "usage: %s serve [port] [copy]\n"
+          "       %s send <addr> [port] [MiB]\n",
+          argv[0], argv[0]);
+  return EXIT_FAILURE;
+}
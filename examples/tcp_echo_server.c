@@ -0,0 +1,134 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+// Echo server for load testing, e.g. with examples/tcp_loadgen.
+//
+// usage: tcp_echo_server [port] [trace-file]
+//
+// Serves any number of connections (up to MAX_CONNS) from a single poll()
+// loop and writes everything it receives back to the sender. With a trace
+// file, all traffic is recorded (see micro-sockets/trace.h) until the server
+// is stopped with Ctrl-C, for replay with examples/tcp_replay.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/tcp.h"
+#include "micro-sockets/trace.h"
+
+#define MAX_CONNS 1024
+
+// Interrupts poll() so the trace gets flushed on Ctrl-C
+static void on_signal(int32_t sig) {
+  (void)sig;
+}
+
+static int32_t send_all(tcp_connection_t* conn, box_t data) {
+  while (data.size > 0) {
+    ssize_t n = tcp_connection__send(conn, data);
+    if (n <= 0) return -1;
+
+    data = box__ctor(data.ptr + n, data.size - _M_cast(size_t, n));
+  }
+
+  return 0;
+}
+
+int32_t main(int32_t argc, char** argv) {
+  uint16_t port = argc > 1 ? _M_cast(uint16_t, atoi(argv[1])) : 4040;
+
+  tcp_server_t* server = tcp_server__new(AF_INET, "0.0.0.0", port);
+  if (server == NULL) {
+    fprintf(stderr, "[echo] could not bind port %u\n", port);
+    return EXIT_FAILURE;
+  }
+
+  if (argc > 2 && trace__start(argv[2], MiB(4), KiB(4)) != 0) {
+    fprintf(stderr, "[echo] could not start trace %s\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  // Clients hanging up mid-send must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  tcp_server__attach_buf(server, buf__new(KiB(64)));
+  tcp_server__listen(server, 128);
+  printf("[echo] listening on 0.0.0.0:%u\n", port);
+
+  // Slot 0 is the listening socket, slots 1..n are the connections
+  struct pollfd fds[MAX_CONNS + 1];
+  tcp_connection_t conns[MAX_CONNS + 1];
+  size_t n = 1;
+
+  fds[0] = (struct pollfd){.fd = server->sock, .events = POLLIN};
+
+  for (;;) {
+    if (poll(fds, n, -1) < 0) break;
+
+    for (size_t i = n - 1; i >= 1; i--) {
+      if (fds[i].revents == 0) continue;
+
+      box_t data = tcp_server__recv(server, &conns[i]);
+      if (data.size > 0 && send_all(&conns[i], data) == 0) continue;
+
+      // EOF or error: close and move the last slot into this one
+      tcp_connection__close(&conns[i]);
+      n--;
+      fds[i] = fds[n];
+      conns[i] = conns[n];
+    }
+
+    if (fds[0].revents & POLLIN) {
+      tcp_connection_t conn = tcp_server__accept(server);
+      if (conn.fd < 0) continue;
+
+      if (n == MAX_CONNS + 1) {
+        tcp_connection__close(&conn);
+        continue;
+      }
+
+      conns[n] = conn;
+      fds[n] = (struct pollfd){.fd = conn.fd, .events = POLLIN};
+      n++;
+    }
+  }
+
+  for (size_t i = 1; i < n; i++) tcp_connection__close(&conns[i]);
+  tcp_server__shutdown(server);
+  tcp_server__free(server);
+
+  if (argc > 2) {
+    printf("[echo] trace written to %s, %llu records dropped\n", argv[2],
+           _M_cast(unsigned long long, trace__dropped()));
+    trace__stop();
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,343 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+// Multi-connection load generator for echo style servers, e.g.
+// examples/tcp_echo_server or examples/tcp_proxy in front of it.
+//
+// usage: tcp_loadgen [-a addr] [-p port] [-c conns] [-d seconds] [-s size]
+//                    [-r rate]
+//
+//   -a  server address                          (default: 127.0.0.1)
+//   -p  server port                             (default: 4040)
+//   -c  number of connections                   (default: 16)
+//   -d  test duration in seconds                (default: 10)
+//   -s  message size in bytes, at least 8       (default: 64)
+//   -r  total messages per second over all connections; 0 runs closed-loop,
+//       where every connection sends its next message as soon as the previous
+//       one came back                           (default: 0)
+//
+// Each message carries its send timestamp in the first 8 bytes, so latency
+// is measured from the echoed copy. In open-loop mode the timestamp is the
+// time the message was scheduled for, not when it was actually written, so
+// a stalled server shows up in the percentiles instead of lowering the rate.
+// Sending still stops after -d; messages that were due but not sent by then
+// are reported separately.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/tcp.h"
+
+typedef struct config_t config_t;
+
+struct config_t {
+  const char* addr;
+  uint16_t port;
+  size_t conns;
+  uint64_t duration_ns;
+  size_t size;
+  uint64_t rate;
+};
+
+typedef struct worker_t worker_t;
+
+struct worker_t {
+  const config_t* cfg;
+  tcp_client_t* client;
+  uint64_t start_ns;
+  uint64_t phase_ns;
+  uint64_t* lat;
+  size_t lat_len;  // messages that came back
+  size_t lat_cap;
+  uint64_t sent;    // messages written completely
+  uint64_t unsent;  // scheduled messages still due when the test ended
+  uint64_t errors;  // failed sends
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return _M_cast(uint64_t, ts.tv_sec) * 1000000000ull +
+         _M_cast(uint64_t, ts.tv_nsec);
+}
+
+static void sleep_until_ns(uint64_t t) {
+  // Behind schedule already, e.g. after a blocked send: a past deadline would
+  // still cost a timer and a reschedule
+  if (t <= now_ns()) return;
+
+  struct timespec ts = {.tv_sec = _M_cast(time_t, t / 1000000000ull),
+                        .tv_nsec = _M_cast(long, t % 1000000000ull)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+  }
+}
+
+static void worker__record(worker_t* self, uint64_t lat) {
+  if (self->lat_len == self->lat_cap) {
+    self->lat_cap = self->lat_cap == 0 ? 4096 : self->lat_cap * 2;
+    self->lat = _M_cast(uint64_t*,
+                        realloc(self->lat, self->lat_cap * sizeof(uint64_t)));
+  }
+
+  self->lat[self->lat_len++] = lat;
+}
+
+static int32_t send_msg(worker_t* self, uint8_t* msg, uint64_t stamp) {
+  memcpy(msg, &stamp, sizeof(stamp));
+  box_t data = box__ctor(msg, self->cfg->size);
+
+  while (data.size > 0) {
+    ssize_t n = tcp_client__send(self->client, data);
+    if (n <= 0) return -1;
+
+    data = box__ctor(data.ptr + n, data.size - _M_cast(size_t, n));
+  }
+
+  self->sent++;
+  return 0;
+}
+
+// Reads exactly one echoed message into the client buffer and records its
+// latency. Returns -1 on EOF or error.
+static int32_t recv_msg(worker_t* self) {
+  tcp_connection_t conn = tcp_client__as_tcp__connection(self->client);
+  buf_t* buf = self->client->buf;
+  size_t got = 0;
+
+  while (got < self->cfg->size) {
+    buf_t window = {.ptr = buf->ptr + got, .len = 0,
+                    .size = self->cfg->size - got};
+    ssize_t n = tcp_connection__recv(&conn, &window);
+    if (n <= 0) return -1;
+
+    got += _M_cast(size_t, n);
+  }
+
+  uint64_t stamp;
+  memcpy(&stamp, buf->ptr, sizeof(stamp));
+  worker__record(self, now_ns() - stamp);
+
+  return 0;
+}
+
+static void* closed_loop(void* arg) {
+  worker_t* self = _M_cast(worker_t*, arg);
+  uint8_t* msg = _M_cast(uint8_t*, calloc(1, self->cfg->size));
+  uint64_t end = self->start_ns + self->cfg->duration_ns;
+
+  while (now_ns() < end) {
+    if (send_msg(self, msg, now_ns()) != 0) {
+      self->errors++;
+      break;
+    }
+
+    // A missing echo is reported as lost message by main
+    if (recv_msg(self) != 0) break;
+  }
+
+  free(msg);
+  return NULL;
+}
+
+static void* open_loop_rx(void* arg) {
+  worker_t* self = _M_cast(worker_t*, arg);
+  while (recv_msg(self) == 0) {
+  }
+
+  return NULL;
+}
+
+static void* open_loop_tx(void* arg) {
+  worker_t* self = _M_cast(worker_t*, arg);
+  uint8_t* msg = _M_cast(uint8_t*, calloc(1, self->cfg->size));
+  uint64_t interval = 1000000000ull * self->cfg->conns / self->cfg->rate;
+  uint64_t end = self->start_ns + self->cfg->duration_ns;
+
+  for (uint64_t next = self->start_ns + self->phase_ns; next < end;
+       next += interval) {
+    // The server fell behind so far that the test is over, -d wins
+    if (now_ns() >= end) {
+      self->unsent = (end - next + interval - 1) / interval;
+      break;
+    }
+
+    sleep_until_ns(next);
+    if (send_msg(self, msg, next) != 0) {
+      self->errors++;
+      break;
+    }
+  }
+
+  // Half-close, the server closes once everything is echoed which ends rx
+  shutdown(self->client->sock, SHUT_WR);
+  free(msg);
+
+  return NULL;
+}
+
+static int32_t cmp_u64(const void* a, const void* b) {
+  uint64_t x = *_M_cast(const uint64_t*, a);
+  uint64_t y = *_M_cast(const uint64_t*, b);
+
+  return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint64_t* sorted, size_t n, double p) {
+  if (n == 0) return 0.0;
+
+  size_t idx = _M_cast(size_t, p / 100.0 * _M_cast(double, n - 1) + 0.5);
+  return _M_cast(double, sorted[idx]) / 1000.0;
+}
+
+int32_t main(int32_t argc, char** argv) {
+  config_t cfg = {.addr = "127.0.0.1", .port = 4040, .conns = 16,
+                  .duration_ns = 10000000000ull, .size = 64, .rate = 0};
+
+  int32_t opt;
+  while ((opt = getopt(argc, argv, "a:p:c:d:s:r:")) != -1) {
+    switch (opt) {
+      case 'a': cfg.addr = optarg; break;
+      case 'p': cfg.port = _M_cast(uint16_t, atoi(optarg)); break;
+      case 'c': cfg.conns = strtoull(optarg, NULL, 10); break;
+      case 'd': cfg.duration_ns = strtoull(optarg, NULL, 10) * 1000000000ull;
+        break;
+      case 's': cfg.size = strtoull(optarg, NULL, 10); break;
+      case 'r': cfg.rate = strtoull(optarg, NULL, 10); break;
+      default: return EXIT_FAILURE;
+    }
+  }
+
+  if (cfg.conns == 0 || cfg.size < sizeof(uint64_t)) {
+    fprintf(stderr, "[loadgen] need -c >= 1 and -s >= 8\n");
+    return EXIT_FAILURE;
+  }
+  if (cfg.rate > 1000000000ull * cfg.conns) {
+    fprintf(stderr, "[loadgen] need -r <= 1e9 per connection\n");
+    return EXIT_FAILURE;
+  }
+
+  // A server going away mid-send shows up as an error, not a dead process
+  signal(SIGPIPE, SIG_IGN);
+
+  worker_t* workers = _M_cast(worker_t*, calloc(cfg.conns, sizeof(worker_t)));
+  pthread_t* tx = _M_cast(pthread_t*, calloc(cfg.conns, sizeof(pthread_t)));
+  pthread_t* rx = _M_cast(pthread_t*, calloc(cfg.conns, sizeof(pthread_t)));
+  int32_t one = 1;
+
+  for (size_t i = 0; i < cfg.conns; i++) {
+    tcp_client_t* client = tcp_client__new(AF_INET, cfg.addr, cfg.port);
+    if (client == NULL || tcp_client__connect(client) != 0) {
+      fprintf(stderr, "[loadgen] could not connect to %s:%u\n", cfg.addr,
+              cfg.port);
+      return EXIT_FAILURE;
+    }
+
+    setsockopt(client->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    tcp_client__attach_buf(client, buf__new(cfg.size));
+
+    workers[i].cfg = &cfg;
+    workers[i].client = client;
+  }
+
+  printf("[loadgen] %s:%u, %zu conns, %zu byte msgs, %s", cfg.addr, cfg.port,
+         cfg.conns, cfg.size, cfg.rate == 0 ? "closed-loop" : "open-loop");
+  if (cfg.rate != 0) {
+    printf(" at %llu msg/s", _M_cast(unsigned long long, cfg.rate));
+  }
+  printf("\n");
+
+  // Spread the open-loop send times of the connections over one interval
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < cfg.conns; i++) {
+    workers[i].start_ns = start;
+
+    if (cfg.rate == 0) {
+      pthread_create(&tx[i], NULL, closed_loop, &workers[i]);
+    } else {
+      workers[i].phase_ns = 1000000000ull * i / cfg.rate;
+      pthread_create(&rx[i], NULL, open_loop_rx, &workers[i]);
+      pthread_create(&tx[i], NULL, open_loop_tx, &workers[i]);
+    }
+  }
+
+  size_t total = 0;
+  uint64_t sent = 0;
+  uint64_t unsent = 0;
+  uint64_t errors = 0;
+  for (size_t i = 0; i < cfg.conns; i++) {
+    pthread_join(tx[i], NULL);
+    if (cfg.rate != 0) pthread_join(rx[i], NULL);
+
+    total += workers[i].lat_len;
+    sent += workers[i].sent;
+    unsent += workers[i].unsent;
+    errors += workers[i].errors;
+  }
+
+  // Everything written but never echoed back, e.g. dropped by a proxy
+  uint64_t lost = sent > total ? sent - total : 0;
+  errors += lost;
+  double elapsed_s = _M_cast(double, now_ns() - start) / 1e9;
+
+  uint64_t* lat = _M_cast(uint64_t*, malloc((total + 1) * sizeof(uint64_t)));
+  size_t off = 0;
+  for (size_t i = 0; i < cfg.conns; i++) {
+    memcpy(lat + off, workers[i].lat, workers[i].lat_len * sizeof(uint64_t));
+    off += workers[i].lat_len;
+
+    free(workers[i].lat);
+    tcp_client__close(workers[i].client);
+    tcp_client__free(workers[i].client);
+  }
+  qsort(lat, total, sizeof(uint64_t), cmp_u64);
+
+  double msgs_s = _M_cast(double, total) / elapsed_s;
+  printf("[loadgen] %zu msgs in %.2fs, %.0f msg/s, %.2f MiB/s, %llu lost, "
+         "%llu errors\n",
+         total, elapsed_s, msgs_s, msgs_s * _M_cast(double, cfg.size) / MiB(1),
+         _M_cast(unsigned long long, lost),
+         _M_cast(unsigned long long, errors));
+  if (unsent != 0) {
+    printf("[loadgen] %llu scheduled msgs were not sent within -d\n",
+           _M_cast(unsigned long long, unsent));
+  }
+  printf("[loadgen] latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  "
+         "max %.1f\n",
+         percentile_us(lat, total, 50.0), percentile_us(lat, total, 90.0),
+         percentile_us(lat, total, 99.0), percentile_us(lat, total, 99.9),
+         percentile_us(lat, total, 100.0));
+
+  free(lat);
+  free(rx);
+  free(tx);
+  free(workers);
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,250 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+// Transparent TCP proxy, e.g. to put between examples/tcp_loadgen and
+// examples/tcp_echo_server to measure the cost of an extra hop.
+//
+// usage: tcp_proxy <listen-port> <upstream-addr> <upstream-port>
+//
+// Every accepted connection gets its own upstream connection. Both sides of
+// all pairs are non-blocking and served from a single poll() loop. Data the
+// destination cannot take yet is kept per direction, and the source is not
+// read again until it has been flushed, so one slow peer only stalls its own
+// pair. EOF is forwarded as a half-close once the pending data is out.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/tcp.h"
+
+#define MAX_PAIRS 512
+#define FLOW_BUF KiB(64)
+
+typedef struct flow_t flow_t;
+typedef struct pair_t pair_t;
+
+// One direction of a pair. `buf` holds data read from the source that the
+// destination has not taken yet, starting at `off`.
+struct flow_t {
+  buf_t* buf;
+  size_t off;
+  bool eof;   // source hit EOF
+  bool shut;  // EOF forwarded to the destination
+};
+
+struct pair_t {
+  tcp_connection_t down;
+  tcp_client_t* up;
+  flow_t to_up;
+  flow_t to_down;
+};
+
+static bool flow__pending(flow_t* self) {
+  return self->off < self->buf->len;
+}
+
+// Sends as much pending data as `to` takes without blocking, then forwards
+// EOF once everything is out. Returns -1 on error.
+static int32_t flow__flush(flow_t* self, tcp_connection_t* to) {
+  while (flow__pending(self)) {
+    box_t data =
+        box__ctor(self->buf->ptr + self->off, self->buf->len - self->off);
+    ssize_t n = tcp_connection__send(to, data);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+    self->off += _M_cast(size_t, n);
+  }
+
+  if (self->eof && !self->shut) {
+    if (shutdown(to->fd, SHUT_WR) != 0) return -1;
+    self->shut = true;
+  }
+
+  return 0;
+}
+
+// Reads one chunk from `from` into the empty flow and passes it on to `to`.
+// Returns -1 on error.
+static int32_t flow__relay(flow_t* self, tcp_connection_t* from,
+                           tcp_connection_t* to) {
+  ssize_t n = tcp_connection__recv(from, self->buf);
+  if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+  self->off = 0;
+  if (n == 0) self->eof = true;
+
+  return flow__flush(self, to);
+}
+
+// Events to poll a socket for, given the flow it `feeds` and the flow it
+// `drains`. Input is only read while the flow it feeds is empty, output is
+// only waited for while data is pending.
+static int16_t flow__events(flow_t* feeds, flow_t* drains) {
+  int16_t events = 0;
+  if (!feeds->eof && !flow__pending(feeds)) events |= POLLIN;
+  if (flow__pending(drains)) events |= POLLOUT;
+
+  return events;
+}
+
+static void pollfd__set(struct pollfd* pfd, sock_t fd, int16_t events) {
+  // poll() skips negative fds, so an fd with nothing to wait for can not
+  // wake the loop with POLLHUP while its flow is stalled
+  pfd->fd = events != 0 ? fd : -1;
+  pfd->events = events;
+  pfd->revents = 0;
+}
+
+// Handles one side of a pair: `in` flows from `self` to `peer`, `out` from
+// `peer` to `self`. Returns -1 on error.
+static int32_t pair__step(tcp_connection_t* self, tcp_connection_t* peer,
+                          flow_t* in, flow_t* out, int16_t revents) {
+  if (revents & POLLERR) return -1;
+  if ((revents & POLLOUT) && flow__flush(out, self) != 0) return -1;
+  if ((revents & (POLLIN | POLLHUP)) && !in->eof && !flow__pending(in)) {
+    return flow__relay(in, self, peer);
+  }
+
+  return 0;
+}
+
+static bool pair__done(pair_t* self) {
+  return self->to_up.shut && self->to_down.shut;
+}
+
+static void pair__close(pair_t* pair) {
+  tcp_connection__close(&pair->down);
+  tcp_client__close(pair->up);
+  tcp_client__free(pair->up);
+  buf__free(pair->to_up.buf);
+  buf__free(pair->to_down.buf);
+}
+
+int32_t main(int32_t argc, char** argv) {
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s <listen-port> <upstream-addr> <upstream-port>\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  uint16_t port = _M_cast(uint16_t, atoi(argv[1]));
+  const char* up_addr = argv[2];
+  uint16_t up_port = _M_cast(uint16_t, atoi(argv[3]));
+
+  tcp_server_t* server = tcp_server__new(AF_INET, "0.0.0.0", port);
+  if (server == NULL) {
+    fprintf(stderr, "[proxy] could not bind port %u\n", port);
+    return EXIT_FAILURE;
+  }
+
+  // Either side hanging up mid-send must not kill the proxy
+  signal(SIGPIPE, SIG_IGN);
+
+  // Data is read into the per-flow buffers, tcp_server__listen still wants
+  // one on the server
+  tcp_server__attach_buf(server, buf__new(KiB(4)));
+  tcp_server__listen(server, 128);
+  printf("[proxy] 0.0.0.0:%u -> %s:%u\n", port, up_addr, up_port);
+
+  // fds[0] is the listening socket, pair i uses fds[1 + 2i] (downstream) and
+  // fds[2 + 2i] (upstream). They are rebuilt from the flows before each poll.
+  struct pollfd fds[2 * MAX_PAIRS + 1];
+  pair_t pairs[MAX_PAIRS];
+  size_t n = 0;
+
+  fds[0] = (struct pollfd){.fd = server->sock, .events = POLLIN};
+
+  for (;;) {
+    for (size_t i = 0; i < n; i++) {
+      pair_t* pair = &pairs[i];
+      pollfd__set(&fds[1 + 2 * i], pair->down.fd,
+                  flow__events(&pair->to_up, &pair->to_down));
+      pollfd__set(&fds[2 + 2 * i], pair->up->sock,
+                  flow__events(&pair->to_down, &pair->to_up));
+    }
+
+    if (poll(fds, 2 * n + 1, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    for (size_t i = n; i-- > 0;) {
+      pair_t* pair = &pairs[i];
+      tcp_connection_t up = tcp_client__as_tcp__connection(pair->up);
+      int32_t err = pair__step(&pair->down, &up, &pair->to_up,
+                               &pair->to_down, fds[1 + 2 * i].revents);
+      if (err == 0) {
+        err = pair__step(&up, &pair->down, &pair->to_down, &pair->to_up,
+                         fds[2 + 2 * i].revents);
+      }
+      if (err == 0 && !pair__done(pair)) continue;
+
+      // Error, or EOF forwarded in both directions: drop the pair and move
+      // the last one here
+      pair__close(pair);
+      pairs[i] = pairs[--n];
+    }
+
+    if (fds[0].revents & POLLIN) {
+      tcp_connection_t down = tcp_server__accept(server);
+      if (down.fd < 0) continue;
+
+      tcp_client_t* up = tcp_client__new(AF_INET, up_addr, up_port);
+      buf_t* to_up = buf__new(FLOW_BUF);
+      buf_t* to_down = buf__new(FLOW_BUF);
+      if (n == MAX_PAIRS || up == NULL || to_up == NULL || to_down == NULL ||
+          tcp_client__connect(up) != 0) {
+        fprintf(stderr, "[proxy] dropping connection\n");
+        tcp_connection__close(&down);
+        if (up != NULL) {
+          tcp_client__close(up);
+          tcp_client__free(up);
+        }
+        if (to_up != NULL) buf__free(to_up);
+        if (to_down != NULL) buf__free(to_down);
+        continue;
+      }
+
+      fcntl(down.fd, F_SETFL, fcntl(down.fd, F_GETFL) | O_NONBLOCK);
+      fcntl(up->sock, F_SETFL, fcntl(up->sock, F_GETFL) | O_NONBLOCK);
+      pairs[n++] = (pair_t){
+          .down = down,
+          .up = up,
+          .to_up = {.buf = to_up},
+          .to_down = {.buf = to_down},
+      };
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) pair__close(&pairs[i]);
+  tcp_server__shutdown(server);
+  tcp_server__free(server);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,256 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+// Replays a traffic log recorded with micro-sockets/trace.h against a server.
+//
+// usage: tcp_replay [-a addr] [-p port] [-x speed] [-e recv|send] <trace>
+//
+//   -a  target address                             (default: 127.0.0.1)
+//   -p  target port                                (default: 4040)
+//   -x  time scale, 1 keeps the original pacing, 2 runs twice as fast and
+//       0 sends as fast as possible                (default: 1)
+//   -e  which direction of the log to re-send: `recv` for a log recorded
+//       on the server, `send` for one recorded on a client (default: recv)
+//
+// Every traced connection is re-opened as its own client connection and the
+// recorded data is sent in the original order. Records without (or with
+// truncated) payload are padded with zeros to their original size. Whatever
+// the server answers is read and discarded.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/tcp.h"
+#include "micro-sockets/trace.h"
+
+typedef struct entry_t entry_t;
+
+struct entry_t {
+  trace_record_t rec;
+  size_t payload_off;
+  size_t index;  // position in the file, keeps the sort stable
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return _M_cast(uint64_t, ts.tv_sec) * 1000000000ull +
+         _M_cast(uint64_t, ts.tv_nsec);
+}
+
+static void sleep_until_ns(uint64_t t) {
+  // Behind schedule already, which is the common case when replaying faster
+  // than recorded: a past deadline would still cost a timer and a reschedule
+  if (t <= now_ns()) return;
+
+  struct timespec ts = {.tv_sec = _M_cast(time_t, t / 1000000000ull),
+                        .tv_nsec = _M_cast(long, t % 1000000000ull)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+  }
+}
+
+static int32_t cmp_entry(const void* a, const void* b) {
+  const entry_t* x = _M_cast(const entry_t*, a);
+  const entry_t* y = _M_cast(const entry_t*, b);
+
+  if (x->rec.ts_ns != y->rec.ts_ns) {
+    return x->rec.ts_ns < y->rec.ts_ns ? -1 : 1;
+  }
+
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+static void drain_responses(tcp_client_t* client) {
+  uint8_t sink[KiB(16)];
+  while (recv(client->sock, sink, sizeof(sink), MSG_DONTWAIT) > 0) {
+  }
+}
+
+static void close_client(tcp_client_t** slot) {
+  if (*slot == NULL) return;
+
+  drain_responses(*slot);
+  tcp_client__close(*slot);
+  tcp_client__free(*slot);
+  *slot = NULL;
+}
+
+int32_t main(int32_t argc, char** argv) {
+  const char* addr = "127.0.0.1";
+  uint16_t port = 4040;
+  double speed = 1.0;
+  uint8_t event = TRACE_RECV;
+
+  int32_t opt;
+  while ((opt = getopt(argc, argv, "a:p:x:e:")) != -1) {
+    switch (opt) {
+      case 'a': addr = optarg; break;
+      case 'p': port = _M_cast(uint16_t, atoi(optarg)); break;
+      case 'x': speed = atof(optarg); break;
+      case 'e':
+        event = strcmp(optarg, "send") == 0 ? TRACE_SEND : TRACE_RECV;
+        break;
+      default: return EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "usage: %s [-a addr] [-p port] [-x speed] "
+                    "[-e recv|send] <trace>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  FILE* file = fopen(argv[optind], "rb");
+  trace_file_header_t header;
+  if (file == NULL || fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+      header.version != TRACE_VERSION) {
+    fprintf(stderr, "[replay] %s is not a micro-sockets trace\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  // Load the whole log, payloads go into one shared buffer
+  entry_t* entries = NULL;
+  size_t n = 0, cap = 0;
+  uint8_t* payload = NULL;
+  size_t payload_len = 0, payload_cap = 0;
+  trace_record_t rec;
+
+  while (fread(&rec, sizeof(rec), 1, file) == 1) {
+    if (n == cap) {
+      cap = cap == 0 ? 1024 : cap * 2;
+      entries = _M_cast(entry_t*, realloc(entries, cap * sizeof(entry_t)));
+    }
+    while (payload_len + rec.payload_len > payload_cap) {
+      payload_cap = payload_cap == 0 ? MiB(1) : payload_cap * 2;
+      payload = _M_cast(uint8_t*, realloc(payload, payload_cap));
+    }
+
+    if (rec.payload_len > 0 &&
+        fread(payload + payload_len, rec.payload_len, 1, file) != 1) {
+      break;
+    }
+
+    entries[n] = (entry_t){.rec = rec, .payload_off = payload_len, .index = n};
+    payload_len += rec.payload_len;
+    n++;
+  }
+  fclose(file);
+
+  if (n == 0) {
+    fprintf(stderr, "[replay] trace is empty\n");
+    return EXIT_FAILURE;
+  }
+  qsort(entries, n, sizeof(entry_t), cmp_entry);
+
+  // Open client connections, indexed by the traced fd
+  size_t n_slots = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t fd = _M_cast(size_t, entries[i].rec.conn);
+    if (entries[i].rec.conn >= 0 && fd + 1 > n_slots) n_slots = fd + 1;
+  }
+  tcp_client_t** clients =
+      _M_cast(tcp_client_t**, calloc(n_slots, sizeof(tcp_client_t*)));
+
+  uint8_t* filler = NULL;
+  size_t filler_len = 0;
+  uint64_t first = entries[0].rec.ts_ns;
+  uint64_t start = now_ns();
+  uint64_t records = 0, bytes = 0, conns = 0, errors = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    const trace_record_t* r = &entries[i].rec;
+    if (r->conn < 0) continue;
+    tcp_client_t** slot = &clients[r->conn];
+
+    if (r->event == TRACE_CLOSE) {
+      close_client(slot);
+      continue;
+    }
+    if (r->event != event || r->len <= 0) continue;
+
+    if (speed > 0.0) {
+      double offset_ns = _M_cast(double, r->ts_ns - first) / speed;
+      sleep_until_ns(start + _M_cast(uint64_t, offset_ns));
+    }
+
+    if (*slot == NULL) {
+      *slot = tcp_client__new(AF_INET, addr, port);
+      if (*slot == NULL || tcp_client__connect(*slot) != 0) {
+        fprintf(stderr, "[replay] could not connect to %s:%u\n", addr, port);
+        return EXIT_FAILURE;
+      }
+      conns++;
+    }
+
+    // Recorded payload, padded with zeros up to the original size
+    size_t size = _M_cast(size_t, r->len);
+    box_t data = box__ctor(payload + entries[i].payload_off, r->payload_len);
+    if (r->payload_len < size) {
+      if (filler_len < size) {
+        filler = _M_cast(uint8_t*, realloc(filler, size));
+        filler_len = size;
+      }
+      memcpy(filler, data.ptr, data.size);
+      memset(filler + data.size, 0, size - data.size);
+      data = box__ctor(filler, size);
+    }
+
+    while (data.size > 0) {
+      ssize_t sent = tcp_client__send(*slot, data);
+      if (sent <= 0) {
+        errors++;
+        break;
+      }
+      data = box__ctor(data.ptr + sent, data.size - _M_cast(size_t, sent));
+    }
+
+    drain_responses(*slot);
+    records++;
+    bytes += size;
+  }
+
+  for (size_t i = 0; i < n_slots; i++) close_client(&clients[i]);
+
+  double elapsed_s = _M_cast(double, now_ns() - start) / 1e9;
+  double original_s =
+      _M_cast(double, entries[n - 1].rec.ts_ns - first) / 1e9;
+  printf("[replay] %llu records, %llu bytes over %llu connections in %.2fs "
+         "(recorded: %.2fs), %llu errors\n",
+         _M_cast(unsigned long long, records),
+         _M_cast(unsigned long long, bytes),
+         _M_cast(unsigned long long, conns), elapsed_s, original_s,
+         _M_cast(unsigned long long, errors));
+
+  free(clients);
+  free(filler);
+  free(payload);
+  free(entries);
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,52 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+#ifndef __MICRO_SOCKETS___ATOMIC__H
+#define __MICRO_SOCKETS___ATOMIC__H
+
+// C11 atomics for the lock-free parts of the library. <stdatomic.h> is only
+// part of C++ since C++23, so C++ builds map the same names onto
+// std::atomic, which is layout and behaviour compatible.
+
+#include "micro-sockets/_defs.h"  // pulls in <atomic> ahead of ccms
+
+#ifdef __cplusplus
+#define __MICRO_SOCKETS__ATOMIC(T) std::atomic<T>
+
+using std::atomic_bool;
+using std::atomic_compare_exchange_strong;
+using std::atomic_compare_exchange_weak;
+using std::atomic_exchange;
+using std::atomic_fetch_add;
+using std::atomic_fetch_add_explicit;
+using std::atomic_init;
+using std::atomic_load;
+using std::atomic_load_explicit;
+using std::atomic_store;
+using std::atomic_store_explicit;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+#else
+#include <stdatomic.h>
+
+#define __MICRO_SOCKETS__ATOMIC(T) _Atomic(T)
+#endif
+
+#endif  // __MICRO_SOCKETS___ATOMIC__H
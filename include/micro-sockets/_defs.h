@@ -26,6 +26,15 @@
 #define __MICRO_SOCKETS__IS_WINDOWS 0
 #endif
 
+// Every header includes this one first, so <atomic> is seen before
+// ccms/_macros.h. Its function-like macros, e.g. _M_addr, collide with
+// member names in libstdc++'s <atomic> from C++20 on. See _atomic.h.
+#ifdef __cplusplus
+extern "C++" {
+#include <atomic>
+}
+#endif
+
 #ifdef __MICRO_SOCKETS__EXTERN
 #define __MICRO_SOCKETS__INLINE extern inline
 #else
@@ -0,0 +1,511 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+#ifndef __MICRO_SOCKETS__MAILBOX__H
+#define __MICRO_SOCKETS__MAILBOX__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+
+// Pin to the top of file, becuase it is used in the definitions of include
+// macros like __MICRO_SOCKETS__IS_WINDOWS, DO NOT MOVE THIS INCLUDE !!!
+#include "micro-sockets/_defs.h"
+
+// clang-format on
+
+#if __MICRO_SOCKETS__IS_WINDOWS
+#error "micro-sockets/mailbox.h is not supported on Windows yet"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/_atomic.h"
+#include "micro-sockets/mpsc.h"
+#include "micro-sockets/tcp.h"
+
+// A mailbox belongs to one I/O thread, the thread that owns a set of
+// tcp_connection_t. Any thread can post tasks to it; the owner polls
+// `io_mailbox__fd` together with its sockets and runs the posted tasks in
+// batches with `io_mailbox__drain`. This way sends to a connection never
+// race with the owner and no lock is needed around them.
+//
+// Other threads never hold a tcp_connection_t pointer: the owner registers
+// each connection and hands out an `io_conn_id_t`, which is checked again
+// when the task runs, so sends to a connection closed in the meantime are
+// dropped instead of going to a reused fd or slot.
+//
+// Sends never block the owner. Whatever the socket does not take right away
+// is kept in a per-connection backlog; the owner polls the connection for
+// POLLOUT while `io_mailbox__backlog` is non-zero and calls
+// `io_mailbox__flush` when it is writable. A send that fails for good, e.g.
+// on a reset connection, drops the backlog; the owner sees the error on its
+// next recv.
+//
+// Wakeups are coalesced: only the first post after a drain signals the fd.
+// On Linux the fd is an eventfd, elsewhere the read end of a pipe.
+
+typedef struct io_task_t io_task_t;
+
+typedef void (*io_task_fn)(io_task_t* task);
+
+// Embed as first member in a custom struct to post arbitrary closures.
+struct io_task_t {
+  mpsc_node_t node;
+  io_task_fn fn;
+};
+
+// Handle for a connection registered with a mailbox, safe to pass to other
+// threads. It combines the slot and its generation, so the id of a
+// connection that was unregistered never matches a later connection in the
+// same slot. 0 is never a valid id.
+typedef uint64_t io_conn_id_t;
+
+#define _IO_CONN_NONE UINT32_MAX
+
+typedef struct io_mailbox_t io_mailbox_t;
+typedef struct _io_send_task_t _io_send_task_t;
+
+// The copied payload directly follows the struct in the same allocation
+struct _io_send_task_t {
+  io_task_t task;
+  io_mailbox_t* mailbox;
+  io_conn_id_t id;
+  size_t size;
+  _io_send_task_t* next;  // in the backlog of the connection
+};
+
+typedef struct _io_conn_slot_t _io_conn_slot_t;
+
+struct _io_conn_slot_t {
+  tcp_connection_t conn;
+  uint32_t gen;        // odd while the slot is in use
+  uint32_t next_free;  // next unused slot, _IO_CONN_NONE at the end
+
+  // Sends the socket did not take yet, oldest first. The first `sent` bytes
+  // of `head` are already out, `pending` counts what is left in total.
+  _io_send_task_t* head;
+  _io_send_task_t* tail;
+  size_t sent;
+  size_t pending;
+};
+
+struct io_mailbox_t {
+  mpsc_queue_t queue;
+  atomic_bool pending;
+  int32_t rfd;
+  int32_t wfd;
+
+  // Connection registry, only touched by the owning thread
+  _io_conn_slot_t* slots;
+  uint32_t n_slots;
+  uint32_t free_slot;
+};
+
+__MICRO_SOCKETS__INLINE
+void _io_conn_slot__clear(_io_conn_slot_t* self) {
+  while (self->head != NULL) {
+    _io_send_task_t* next = self->head->next;
+    _M_free(self->head);
+    self->head = next;
+  }
+
+  self->tail = NULL;
+  self->sent = 0;
+  self->pending = 0;
+}
+
+// Owning thread only, after all producers stopped posting. Drops all
+// backlogs and queued sends; queued closures still run, so they can release
+// whatever they own.
+__MICRO_SOCKETS__INLINE
+void io_mailbox__free(io_mailbox_t* self) {
+  for (uint32_t i = 0; i < self->n_slots; i++) {
+    _io_conn_slot_t* slot = &self->slots[i];
+    if (!(slot->gen & 1)) continue;
+
+    _io_conn_slot__clear(slot);
+    slot->gen++;  // queued sends for it are freed without sending below
+  }
+
+  mpsc_node_t* node;
+  while ((node = mpsc_queue__pop(&self->queue)) != NULL) {
+    io_task_t* task = _M_cast(io_task_t*, node);
+    task->fn(task);
+  }
+
+  if (self->wfd != self->rfd && self->wfd >= 0) close(self->wfd);
+  if (self->rfd >= 0) close(self->rfd);
+  if (self->slots != NULL) _M_free(self->slots);
+  _M_free(self);
+}
+
+__MICRO_SOCKETS__INLINE
+io_mailbox_t* io_mailbox__new(void) {
+  io_mailbox_t* self = _M_new(io_mailbox_t);
+  if (self == NULL) return NULL;
+
+  mpsc_queue__init(&self->queue);
+  atomic_init(&self->pending, false);
+  self->rfd = -1;
+  self->wfd = -1;
+  self->slots = NULL;
+  self->n_slots = 0;
+  self->free_slot = _IO_CONN_NONE;
+
+#if defined(__linux__)
+  self->rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  self->wfd = self->rfd;
+#else
+  int32_t fds[2];
+  if (pipe(fds) == 0) {
+    self->rfd = fds[0];
+    self->wfd = fds[1];
+    fcntl(self->rfd, F_SETFL, O_NONBLOCK);
+    fcntl(self->wfd, F_SETFL, O_NONBLOCK);
+  }
+#endif
+
+  if (self->rfd < 0) {
+    io_mailbox__free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+// File descriptor that becomes readable when tasks are waiting. Add it to
+// the poll/epoll set of the owning thread.
+__MICRO_SOCKETS__INLINE
+int32_t io_mailbox__fd(const io_mailbox_t* self) {
+  return self->rfd;
+}
+
+__MICRO_SOCKETS__INLINE
+void _io_mailbox__signal(io_mailbox_t* self) {
+  uint64_t one = 1;
+  ssize_t n;
+
+  // A full pipe/eventfd (EAGAIN) already signals readability, nothing lost
+  do {
+    n = write(self->wfd, &one, self->wfd == self->rfd ? sizeof(one) : 1);
+  } while (n < 0 && errno == EINTR);
+}
+
+__MICRO_SOCKETS__INLINE
+void _io_mailbox__reset(io_mailbox_t* self) {
+  uint8_t sink[64];
+
+  // One read resets an eventfd, a pipe has to be emptied
+  if (self->rfd == self->wfd) {
+    ssize_t n = read(self->rfd, sink, sizeof(uint64_t));
+    (void)n;
+    return;
+  }
+
+  while (read(self->rfd, sink, sizeof(sink)) > 0) {
+  }
+}
+
+//
+//
+// ------------------------- CONNECTIONS -------------------------
+//
+//
+
+// Owning thread only. Registers `conn` so other threads can address it with
+// the returned id. Returns 0 if the registry could not grow.
+__MICRO_SOCKETS__INLINE
+io_conn_id_t io_mailbox__register(io_mailbox_t* self, tcp_connection_t conn) {
+  if (self->free_slot == _IO_CONN_NONE) {
+    uint32_t cap = self->n_slots == 0 ? 64 : self->n_slots * 2;
+    _io_conn_slot_t* slots = _M_cast(
+        _io_conn_slot_t*, realloc(self->slots, cap * sizeof(_io_conn_slot_t)));
+    if (slots == NULL) return 0;
+
+    // Chain the new slots into the free list, all start at generation 0
+    for (uint32_t i = self->n_slots; i < cap; i++) {
+      slots[i].gen = 0;
+      slots[i].next_free = i + 1 < cap ? i + 1 : _IO_CONN_NONE;
+    }
+
+    self->free_slot = self->n_slots;
+    self->slots = slots;
+    self->n_slots = cap;
+  }
+
+  uint32_t idx = self->free_slot;
+  _io_conn_slot_t* slot = &self->slots[idx];
+
+  self->free_slot = slot->next_free;
+  slot->conn = conn;
+  slot->gen++;
+  slot->head = NULL;
+  slot->tail = NULL;
+  slot->sent = 0;
+  slot->pending = 0;
+
+  return (_M_cast(io_conn_id_t, slot->gen) << 32) | idx;
+}
+
+__MICRO_SOCKETS__INLINE
+_io_conn_slot_t* _io_mailbox__slot(io_mailbox_t* self, io_conn_id_t id) {
+  uint32_t idx = _M_cast(uint32_t, id);
+  uint32_t gen = _M_cast(uint32_t, id >> 32);
+
+  if (idx >= self->n_slots || self->slots[idx].gen != gen || !(gen & 1)) {
+    return NULL;
+  }
+
+  return &self->slots[idx];
+}
+
+// Owning thread only. Returns the registered connection, or NULL if `id`
+// was unregistered in the meantime.
+__MICRO_SOCKETS__INLINE
+tcp_connection_t* io_mailbox__conn(io_mailbox_t* self, io_conn_id_t id) {
+  _io_conn_slot_t* slot = _io_mailbox__slot(self, id);
+  return slot == NULL ? NULL : &slot->conn;
+}
+
+// Owning thread only. Call before closing the connection; its backlog is
+// dropped and tasks still queued for `id` are dropped from then on.
+__MICRO_SOCKETS__INLINE
+void io_mailbox__unregister(io_mailbox_t* self, io_conn_id_t id) {
+  _io_conn_slot_t* slot = _io_mailbox__slot(self, id);
+  if (slot == NULL) return;
+
+  _io_conn_slot__clear(slot);
+  slot->gen++;
+  slot->next_free = self->free_slot;
+  self->free_slot = _M_cast(uint32_t, id);
+}
+
+//
+//
+// ------------------------- TASKS -------------------------
+//
+//
+
+// Queues `task` to run `fn` on the owning thread. Safe to call from any
+// thread. `task` must stay valid until `fn` was called; `fn` may free it.
+__MICRO_SOCKETS__INLINE
+void io_mailbox__post(io_mailbox_t* self, io_task_t* task, io_task_fn fn) {
+  task->fn = fn;
+  mpsc_queue__push(&self->queue, &task->node);
+
+  if (!atomic_exchange(&self->pending, true)) _io_mailbox__signal(self);
+}
+
+// Owning thread only. Runs up to `max` queued tasks (0 means all) in FIFO
+// order and returns how many ran. If tasks are left over, or one is still
+// being posted, the fd is signalled again so the next poll returns right
+// away. The I/O thread never spins waiting for a producer.
+__MICRO_SOCKETS__INLINE
+size_t io_mailbox__drain(io_mailbox_t* self, size_t max) {
+  _io_mailbox__reset(self);
+
+  // Clear before popping: a post that still sees `pending` set is then
+  // guaranteed to be visible to the loop below.
+  atomic_store(&self->pending, false);
+
+  size_t n = 0;
+  while ((max == 0 || n < max) && !mpsc_queue__empty(&self->queue)) {
+    // NULL while a producer is between its two stores. Do not spin on it,
+    // the re-signal below makes the next poll pick the task up.
+    mpsc_node_t* node = mpsc_queue__pop(&self->queue);
+    if (node == NULL) break;
+
+    io_task_t* task = _M_cast(io_task_t*, node);
+    task->fn(task);
+    n++;
+  }
+
+  if (!mpsc_queue__empty(&self->queue) &&
+      !atomic_exchange(&self->pending, true)) {
+    _io_mailbox__signal(self);
+  }
+
+  return n;
+}
+
+//
+//
+// ------------------------- SEND -------------------------
+//
+//
+
+// Returns the bytes the socket took, 0 if it is full, -1 on error.
+__MICRO_SOCKETS__INLINE
+ssize_t _io_conn__send_nowait(tcp_connection_t* conn, box_t data) {
+  ssize_t len = send(conn->fd, data.ptr, data.size, MSG_DONTWAIT);
+
+  _sock__trace(TRACE_SEND, conn->fd, data.ptr, len);
+  if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+  return len;
+}
+
+// Sends as much of the backlog as the socket takes. Returns -1 and drops
+// the backlog on error.
+__MICRO_SOCKETS__INLINE
+int32_t _io_conn_slot__flush(_io_conn_slot_t* self) {
+  while (self->head != NULL) {
+    _io_send_task_t* task = self->head;
+    box_t data = box__ctor(_M_cast(uint8_t*, task + 1) + self->sent,
+                           task->size - self->sent);
+    ssize_t n = data.size > 0 ? _io_conn__send_nowait(&self->conn, data) : 0;
+    if (n < 0) {
+      _io_conn_slot__clear(self);
+      return -1;
+    }
+
+    self->sent += _M_cast(size_t, n);
+    self->pending -= _M_cast(size_t, n);
+    if (self->sent < task->size) return 0;  // socket is full
+
+    self->head = task->next;
+    self->sent = 0;
+    _M_free(task);
+  }
+
+  self->tail = NULL;
+  return 0;
+}
+
+__MICRO_SOCKETS__INLINE
+void _io_conn_slot__push(_io_conn_slot_t* self, _io_send_task_t* task) {
+  task->next = NULL;
+  if (self->tail != NULL) {
+    self->tail->next = task;
+  } else {
+    self->head = task;
+  }
+
+  self->tail = task;
+  self->pending += task->size;
+}
+
+__MICRO_SOCKETS__INLINE
+_io_send_task_t* _io_send_task__new(io_mailbox_t* mailbox, io_conn_id_t id,
+                                    box_t data) {
+  _io_send_task_t* self =
+      _M_cast(_io_send_task_t*, _M_alloc(sizeof(_io_send_task_t) + data.size));
+  if (self == NULL) return NULL;
+
+  self->mailbox = mailbox;
+  self->id = id;
+  self->size = data.size;
+  if (data.size > 0) memcpy(_M_cast(uint8_t*, self + 1), data.ptr, data.size);
+
+  return self;
+}
+
+__MICRO_SOCKETS__INLINE
+void _io_send_task__run(io_task_t* task) {
+  _io_send_task_t* self = _M_cast(_io_send_task_t*, task);
+  _io_conn_slot_t* slot = _io_mailbox__slot(self->mailbox, self->id);
+
+  // Connection was closed after the send was posted, drop it
+  if (slot == NULL) {
+    _M_free(self);
+    return;
+  }
+
+  // Queue behind older sends to keep their order, the flush frees it
+  _io_conn_slot__push(slot, self);
+  _io_conn_slot__flush(slot);
+}
+
+// Owning thread only. Sends `data` on `id` without blocking; what the socket
+// does not take is copied to the backlog of the connection. Returns -1 if
+// `id` is stale, the send failed or the copy could not be allocated.
+__MICRO_SOCKETS__INLINE
+int32_t io_mailbox__send(io_mailbox_t* self, io_conn_id_t id, box_t data) {
+  _io_conn_slot_t* slot = _io_mailbox__slot(self, id);
+  if (slot == NULL) return -1;
+
+  if (slot->head == NULL && data.size > 0) {
+    ssize_t n = _io_conn__send_nowait(&slot->conn, data);
+    if (n < 0) return -1;
+
+    data = box__ctor(data.ptr + n, data.size - _M_cast(size_t, n));
+  }
+  if (data.size == 0) return 0;
+
+  _io_send_task_t* task = _io_send_task__new(self, id, data);
+  if (task == NULL) return -1;
+
+  _io_conn_slot__push(slot, task);
+  return _io_conn_slot__flush(slot);
+}
+
+// Owning thread only. Bytes queued for `id` that the socket did not take
+// yet, 0 for a stale id. Poll the connection for POLLOUT while non-zero,
+// and drop connections whose backlog keeps growing.
+__MICRO_SOCKETS__INLINE
+size_t io_mailbox__backlog(io_mailbox_t* self, io_conn_id_t id) {
+  _io_conn_slot_t* slot = _io_mailbox__slot(self, id);
+  return slot == NULL ? 0 : slot->pending;
+}
+
+// Owning thread only. Call when the connection polled writable, sends as
+// much of the backlog as fits. Returns -1 on error or for a stale id.
+__MICRO_SOCKETS__INLINE
+int32_t io_mailbox__flush(io_mailbox_t* self, io_conn_id_t id) {
+  _io_conn_slot_t* slot = _io_mailbox__slot(self, id);
+  if (slot == NULL) return -1;
+
+  return _io_conn_slot__flush(slot);
+}
+
+// Copies `data` and sends it from the owning thread on the connection
+// registered as `id`, like `io_mailbox__send`. If the connection was
+// unregistered by the time the mailbox is drained, the data is dropped.
+// Safe to call from any thread. Returns -1 if the copy could not be
+// allocated.
+__MICRO_SOCKETS__INLINE
+int32_t io_mailbox__post_send(io_mailbox_t* self, io_conn_id_t id,
+                              box_t data) {
+  _io_send_task_t* task = _io_send_task__new(self, id, data);
+  if (task == NULL) return -1;
+
+  io_mailbox__post(self, &task->task, _io_send_task__run);
+  return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __MICRO_SOCKETS__MAILBOX__H
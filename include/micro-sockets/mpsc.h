@@ -0,0 +1,122 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+#ifndef __MICRO_SOCKETS__MPSC__H
+#define __MICRO_SOCKETS__MPSC__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+
+// Pin to the top of file, becuase it is used in the definitions of include
+// macros like __MICRO_SOCKETS__IS_WINDOWS, DO NOT MOVE THIS INCLUDE !!!
+#include "micro-sockets/_defs.h"
+
+// clang-format on
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ccms/_macros.h"
+#include "micro-sockets/_atomic.h"
+
+// Intrusive lock-free multi-producer single-consumer queue (Vyukov). Any
+// thread may push, only the owning thread may pop. Nodes are embedded in the
+// caller's structs and are never allocated or freed by the queue.
+
+typedef struct mpsc_node_t mpsc_node_t;
+
+struct mpsc_node_t {
+  __MICRO_SOCKETS__ATOMIC(mpsc_node_t*) next;
+};
+
+typedef struct mpsc_queue_t mpsc_queue_t;
+
+struct mpsc_queue_t {
+  // Last pushed node, shared by producers
+  __MICRO_SOCKETS__ATOMIC(mpsc_node_t*) head;
+  // Next node to pop, consumer only
+  mpsc_node_t* tail;
+  mpsc_node_t stub;
+};
+
+__MICRO_SOCKETS__INLINE
+void mpsc_queue__init(mpsc_queue_t* self) {
+  atomic_init(&self->stub.next, NULL);
+  atomic_init(&self->head, &self->stub);
+  self->tail = &self->stub;
+}
+
+// Safe to call from any thread.
+__MICRO_SOCKETS__INLINE
+void mpsc_queue__push(mpsc_queue_t* self, mpsc_node_t* node) {
+  atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+  mpsc_node_t* prev = atomic_exchange(&self->head, node);
+  atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+// Consumer only. True if no node has been pushed that was not popped yet,
+// including pushes that are still in progress.
+__MICRO_SOCKETS__INLINE
+bool mpsc_queue__empty(mpsc_queue_t* self) {
+  return self->tail == &self->stub && atomic_load(&self->head) == &self->stub;
+}
+
+// Consumer only. Returns the oldest node, or NULL if the queue is empty or
+// the next node is still being linked by a producer. In the latter case
+// `mpsc_queue__empty` is false and the pop can simply be retried.
+__MICRO_SOCKETS__INLINE
+mpsc_node_t* mpsc_queue__pop(mpsc_queue_t* self) {
+  mpsc_node_t* tail = self->tail;
+  mpsc_node_t* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+  if (tail == &self->stub) {
+    if (next == NULL) return NULL;
+
+    self->tail = next;
+    tail = next;
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+  }
+
+  if (next != NULL) {
+    self->tail = next;
+    return tail;
+  }
+
+  if (tail != atomic_load(&self->head)) return NULL;
+
+  // `tail` is the last node, put the stub behind it so it can be handed out
+  mpsc_queue__push(self, &self->stub);
+  next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+  if (next != NULL) {
+    self->tail = next;
+    return tail;
+  }
+
+  return NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __MICRO_SOCKETS__MPSC__H
@@ -0,0 +1,417 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+#ifndef __MICRO_SOCKETS__SCAN__H
+#define __MICRO_SOCKETS__SCAN__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+
+// Pin to the top of file, becuase it is used in the definitions of include
+// macros like __MICRO_SOCKETS__IS_WINDOWS, DO NOT MOVE THIS INCLUDE !!!
+#include "micro-sockets/_defs.h"
+
+// clang-format on
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !__MICRO_SOCKETS__IS_WINDOWS
+#include <sys/types.h>
+#endif
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/buf.h"
+
+// SIMD paths are only compiled on x86 with GCC/Clang, where SSE2 is part of
+// the baseline and AVX2 can be enabled per function and selected at runtime.
+// Every other target uses the scalar fallback.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define __MICRO_SOCKETS__SCAN_X86 1
+#include <immintrin.h>
+#else
+#define __MICRO_SOCKETS__SCAN_X86 0
+#endif
+
+//
+//
+// ------------------------- SCALAR -------------------------
+//
+//
+
+__MICRO_SOCKETS__INLINE
+uint8_t _scan__lower(uint8_t c) {
+  return _M_cast(uint8_t, c | ((_M_cast(uint8_t, c - 'A') < 26) << 5));
+}
+
+__MICRO_SOCKETS__INLINE
+ssize_t _scan__find_scalar(const uint8_t* ptr, size_t size, uint8_t delim) {
+  if (size == 0) return -1;  // memchr must not see a NULL `ptr`
+
+  const uint8_t* hit = _M_cast(const uint8_t*, memchr(ptr, delim, size));
+  return hit == NULL ? -1 : _M_cast(ssize_t, hit - ptr);
+}
+
+__MICRO_SOCKETS__INLINE
+ssize_t _scan__find_crlf_scalar(const uint8_t* ptr, size_t size) {
+  for (size_t i = 0; i + 1 < size; i++) {
+    if (ptr[i] == '\r' && ptr[i + 1] == '\n') return _M_cast(ssize_t, i);
+  }
+
+  return -1;
+}
+
+__MICRO_SOCKETS__INLINE
+size_t _scan__count_scalar(const uint8_t* ptr, size_t size, uint8_t c) {
+  size_t n = 0;
+  for (size_t i = 0; i < size; i++) n += ptr[i] == c;
+
+  return n;
+}
+
+__MICRO_SOCKETS__INLINE
+bool _scan__ieq_scalar(const uint8_t* a, const uint8_t* b, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (_scan__lower(a[i]) != _scan__lower(b[i])) return false;
+  }
+
+  return true;
+}
+
+// Lowercases the ASCII letters in 8 packed bytes. Bytes >= 0x80 are masked
+// out before the range check so they can never look like 'A'..'Z'.
+__MICRO_SOCKETS__INLINE
+uint64_t _scan__lower64(uint64_t x) {
+  const uint64_t ones = 0x0101010101010101ull;
+  uint64_t low7 = x & (0x7F * ones);
+  uint64_t ge_a = low7 + (0x80 - 'A') * ones;
+  uint64_t gt_z = low7 + (0x7F - 'Z') * ones;
+  uint64_t upper = ~x & (ge_a ^ gt_z) & (0x80 * ones);
+
+  return x | (upper >> 2);
+}
+
+__MICRO_SOCKETS__INLINE
+uint64_t _scan__load64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+__MICRO_SOCKETS__INLINE
+uint64_t _scan__load32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Compares views shorter than a vector with two overlapping word loads each,
+// without touching memory past `size`.
+__MICRO_SOCKETS__INLINE
+bool _scan__ieq_short(const uint8_t* a, const uint8_t* b, size_t size) {
+  uint64_t a0, a1, b0, b1;
+  if (size >= 8) {
+    a0 = _scan__load64(a), a1 = _scan__load64(a + size - 8);
+    b0 = _scan__load64(b), b1 = _scan__load64(b + size - 8);
+  } else if (size >= 4) {
+    a0 = _scan__load32(a), a1 = _scan__load32(a + size - 4);
+    b0 = _scan__load32(b), b1 = _scan__load32(b + size - 4);
+  } else {
+    return _scan__ieq_scalar(a, b, size);
+  }
+
+  return _scan__lower64(a0) == _scan__lower64(b0) &&
+         _scan__lower64(a1) == _scan__lower64(b1);
+}
+
+#if __MICRO_SOCKETS__SCAN_X86
+
+//
+//
+// ------------------------- SSE2 -------------------------
+//
+//
+
+__MICRO_SOCKETS__INLINE
+ssize_t _scan__find_crlf_sse2(const uint8_t* ptr, size_t size) {
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  size_t i = 0;
+
+  // Compare the block against '\r' and the block shifted by one against '\n',
+  // so a set bit marks the start of a complete CRLF pair.
+  for (; i + 17 <= size; i += 16) {
+    __m128i v0 = _mm_loadu_si128(_M_cast(const __m128i*, ptr + i));
+    __m128i v1 = _mm_loadu_si128(_M_cast(const __m128i*, ptr + i + 1));
+    __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(v0, cr), _mm_cmpeq_epi8(v1, lf));
+    uint32_t mask = _mm_movemask_epi8(hit);
+    if (mask != 0) return _M_cast(ssize_t, i + __builtin_ctz(mask));
+  }
+
+  ssize_t tail = _scan__find_crlf_scalar(ptr + i, size - i);
+  return tail < 0 ? -1 : _M_cast(ssize_t, i) + tail;
+}
+
+__MICRO_SOCKETS__INLINE
+size_t _scan__count_sse2(const uint8_t* ptr, size_t size, uint8_t c) {
+  const __m128i needle = _mm_set1_epi8(_M_cast(char, c));
+  const __m128i zero = _mm_setzero_si128();
+  size_t n = 0;
+  size_t i = 0;
+
+  // Matches are accumulated as per-byte counters (cmpeq yields -1, so
+  // subtracting it adds one) and folded into `n` before they can overflow.
+  while (i + 16 <= size) {
+    __m128i acc = zero;
+    size_t end = i + 255 * 16;
+    if (end > size) end = size;
+
+    for (; i + 16 <= end; i += 16) {
+      __m128i v = _mm_loadu_si128(_M_cast(const __m128i*, ptr + i));
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+    }
+
+    __m128i sum = _mm_sad_epu8(acc, zero);
+    n += _M_cast(size_t, _mm_cvtsi128_si32(sum)) +
+         _M_cast(size_t, _mm_extract_epi16(sum, 4));
+  }
+
+  return n + _scan__count_scalar(ptr + i, size - i, c);
+}
+
+// Lowercases ASCII letters in `v`. Bytes >= 0x80 are negative as signed chars
+// and therefore never fall into the 'A'..'Z' range.
+__MICRO_SOCKETS__INLINE
+__m128i _scan__lower_sse2(__m128i v) {
+  __m128i ge_a = _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1));
+  __m128i le_z = _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v);
+  __m128i is_upper = _mm_and_si128(ge_a, le_z);
+
+  return _mm_or_si128(v, _mm_and_si128(is_upper, _mm_set1_epi8(0x20)));
+}
+
+__MICRO_SOCKETS__INLINE
+bool _scan__ieq_sse2(const uint8_t* a, const uint8_t* b, size_t size) {
+  size_t i = 0;
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i va = _scan__lower_sse2(
+        _mm_loadu_si128(_M_cast(const __m128i*, a + i)));
+    __m128i vb = _scan__lower_sse2(
+        _mm_loadu_si128(_M_cast(const __m128i*, b + i)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF) return false;
+  }
+
+  return _scan__ieq_scalar(a + i, b + i, size - i);
+}
+
+//
+//
+// ------------------------- AVX2 -------------------------
+//
+//
+
+#define __MICRO_SOCKETS__AVX2 __attribute__((target("avx2,popcnt")))
+
+__MICRO_SOCKETS__INLINE __MICRO_SOCKETS__AVX2
+ssize_t _scan__find_crlf_avx2(const uint8_t* ptr, size_t size) {
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  size_t i = 0;
+
+  for (; i + 33 <= size; i += 32) {
+    __m256i v0 = _mm256_loadu_si256(_M_cast(const __m256i*, ptr + i));
+    __m256i v1 = _mm256_loadu_si256(_M_cast(const __m256i*, ptr + i + 1));
+    __m256i hit =
+        _mm256_and_si256(_mm256_cmpeq_epi8(v0, cr), _mm256_cmpeq_epi8(v1, lf));
+    uint32_t mask = _mm256_movemask_epi8(hit);
+    if (mask != 0) return _M_cast(ssize_t, i + __builtin_ctz(mask));
+  }
+
+  ssize_t tail = _scan__find_crlf_sse2(ptr + i, size - i);
+  return tail < 0 ? -1 : _M_cast(ssize_t, i) + tail;
+}
+
+__MICRO_SOCKETS__INLINE __MICRO_SOCKETS__AVX2
+size_t _scan__count_avx2(const uint8_t* ptr, size_t size, uint8_t c) {
+  const __m256i needle = _mm256_set1_epi8(_M_cast(char, c));
+  size_t n = 0;
+  size_t i = 0;
+
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256(_M_cast(const __m256i*, ptr + i));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    n += __builtin_popcount(mask);
+  }
+
+  return n + _scan__count_sse2(ptr + i, size - i, c);
+}
+
+__MICRO_SOCKETS__INLINE __MICRO_SOCKETS__AVX2
+__m256i _scan__lower_avx2(__m256i v) {
+  __m256i ge_a = _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1));
+  __m256i le_z = _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v);
+  __m256i is_upper = _mm256_and_si256(ge_a, le_z);
+
+  return _mm256_or_si256(v, _mm256_and_si256(is_upper, _mm256_set1_epi8(0x20)));
+}
+
+__MICRO_SOCKETS__INLINE __MICRO_SOCKETS__AVX2
+bool _scan__ieq_avx2(const uint8_t* a, const uint8_t* b, size_t size) {
+  size_t i = 0;
+
+  for (; i + 32 <= size; i += 32) {
+    __m256i va = _scan__lower_avx2(
+        _mm256_loadu_si256(_M_cast(const __m256i*, a + i)));
+    __m256i vb = _scan__lower_avx2(
+        _mm256_loadu_si256(_M_cast(const __m256i*, b + i)));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+    if (mask != 0xFFFFFFFFu) return false;
+  }
+
+  return _scan__ieq_sse2(a + i, b + i, size - i);
+}
+
+// Short inputs never reach the AVX2 paths, so the CPU feature check is only
+// paid where the wider vectors can amortize it.
+__MICRO_SOCKETS__INLINE
+bool _scan__has_avx2(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+#endif  // __MICRO_SOCKETS__SCAN_X86
+
+//
+//
+// ------------------------- PUBLIC -------------------------
+//
+//
+
+// Returns the offset of the first `delim` in `data`, or -1 if there is none.
+// Single byte search is left to memchr, which every mainstream libc already
+// ships in a vectorized, runtime-dispatched form that outruns a hand-rolled
+// loop (see examples/scan_bench.c).
+__MICRO_SOCKETS__INLINE
+ssize_t scan__find(box_t data, uint8_t delim) {
+  return _scan__find_scalar(data.ptr, data.size, delim);
+}
+
+// Returns the offset of the '\r' of the first "\r\n" in `data`, or -1 if
+// there is none.
+__MICRO_SOCKETS__INLINE
+ssize_t scan__find_crlf(box_t data) {
+#if __MICRO_SOCKETS__SCAN_X86
+  if (data.size >= 64 && _scan__has_avx2())
+    return _scan__find_crlf_avx2(data.ptr, data.size);
+  return _scan__find_crlf_sse2(data.ptr, data.size);
+#else
+  return _scan__find_crlf_scalar(data.ptr, data.size);
+#endif
+}
+
+// Returns how often `c` occurs in `data`.
+__MICRO_SOCKETS__INLINE
+size_t scan__count(box_t data, uint8_t c) {
+#if __MICRO_SOCKETS__SCAN_X86
+  if (data.size >= 64 && _scan__has_avx2())
+    return _scan__count_avx2(data.ptr, data.size, c);
+  return _scan__count_sse2(data.ptr, data.size, c);
+#else
+  return _scan__count_scalar(data.ptr, data.size, c);
+#endif
+}
+
+// Returns the number of '\n' terminated lines in `data`.
+__MICRO_SOCKETS__INLINE
+size_t scan__count_lines(box_t data) {
+  return scan__count(data, '\n');
+}
+
+// Case-insensitive (ASCII) comparison of two views.
+__MICRO_SOCKETS__INLINE
+bool scan__ieq(box_t a, box_t b) {
+  if (a.size != b.size) return false;
+  if (a.size == 0) return true;  // `ptr` may be NULL, e.g. from scan__split
+  // Header names and tokens are almost always shorter than a vector
+  if (a.size < 16) return _scan__ieq_short(a.ptr, b.ptr, a.size);
+#if __MICRO_SOCKETS__SCAN_X86
+  if (a.size >= 64 && _scan__has_avx2())
+    return _scan__ieq_avx2(a.ptr, b.ptr, a.size);
+  return _scan__ieq_sse2(a.ptr, b.ptr, a.size);
+#else
+  return _scan__ieq_scalar(a.ptr, b.ptr, a.size);
+#endif
+}
+
+// Case-insensitive (ASCII) match of `data` against the C-string `token`,
+// e.g. a received header name against "Content-Length".
+__MICRO_SOCKETS__INLINE
+bool scan__token_ieq(box_t data, const char* token) {
+  return scan__ieq(data, box__ctor(_M_cast(uint8_t*, token), strlen(token)));
+}
+
+// Splits the next token off `rest` at `delim` and advances `rest` past the
+// delimiter. The returned view points into the original memory. Once `rest`
+// is exhausted a box with `ptr == NULL` is returned.
+__MICRO_SOCKETS__INLINE
+box_t scan__split(box_t* rest, uint8_t delim) {
+  box_t token = *rest;
+  if (rest->ptr == NULL) return token;
+
+  ssize_t idx = scan__find(*rest, delim);
+  if (idx < 0) {
+    *rest = box__ctor(NULL, 0);
+    return token;
+  }
+
+  size_t off = _M_cast(size_t, idx);
+  token.size = off;
+  *rest = box__ctor(rest->ptr + off + 1, rest->size - off - 1);
+
+  return token;
+}
+
+// Like `scan__split` with '\n', but also strips a trailing '\r' from the
+// returned line.
+__MICRO_SOCKETS__INLINE
+box_t scan__split_line(box_t* rest) {
+  box_t line = scan__split(rest, '\n');
+  if (line.size > 0 && line.ptr[line.size - 1] == '\r') line.size--;
+
+  return line;
+}
+
+// Returns the received contents of `buf` as a view.
+__MICRO_SOCKETS__INLINE
+box_t scan__buf(const buf_t* buf) {
+  return box__ctor(buf->ptr, buf->len);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __MICRO_SOCKETS__SCAN__H
@@ -41,6 +41,13 @@ extern "C" {
 #include "micro-sockets/buf.h"
 #include "micro-sockets/sockaddr.h"
 
+#ifdef __MICRO_SOCKETS__TRACE
+#include "micro-sockets/trace.h"
+#define _sock__trace(event, fd, ptr, len) trace__record(event, fd, ptr, len)
+#else
+#define _sock__trace(event, fd, ptr, len) ((void)0)
+#endif
+
 #if __MICRO_SOCKETS__IS_WINDOWS
 typedef SOCKET sock_t;
 #else
@@ -54,12 +61,16 @@ ssize_t _sock__recv(sock_t fd, buf_t* buf) {
   ssize_t len = recv(fd, buf->ptr, buf->size, 0);
   if (len >= 0) buf->len = _M_cast(size_t, len);
 
+  _sock__trace(TRACE_RECV, fd, buf->ptr, len);
   return len;
 }
 
 __MICRO_SOCKETS__INLINE
 ssize_t _sock__send(sock_t fd, box_t data) {
-  return send(fd, data.ptr, data.size, 0);
+  ssize_t len = send(fd, data.ptr, data.size, 0);
+
+  _sock__trace(TRACE_SEND, fd, data.ptr, len);
+  return len;
 }
 
 __MICRO_SOCKETS__INLINE
@@ -84,6 +95,7 @@ ssize_t _sock__bind(sock_t fd, sockaddr_inet_t* sa) {
 
 __MICRO_SOCKETS__INLINE
 int32_t _sock__close(sock_t fd) {
+  _sock__trace(TRACE_CLOSE, fd, NULL, 0);
 #if __MICRO_SOCKETS__IS_WINDOWS
   return closesocket(fd);
 #else
@@ -0,0 +1,530 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+#ifndef __MICRO_SOCKETS__TRACE__H
+#define __MICRO_SOCKETS__TRACE__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+
+// Pin to the top of file, becuase it is used in the definitions of include
+// macros like __MICRO_SOCKETS__IS_WINDOWS, DO NOT MOVE THIS INCLUDE !!!
+#include "micro-sockets/_defs.h"
+
+// clang-format on
+
+#if __MICRO_SOCKETS__IS_WINDOWS
+#error "micro-sockets/trace.h is not supported on Windows yet"
+#endif
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "ccms/_macros.h"
+#include "micro-sockets/_atomic.h"
+
+// Traffic recorder for the send/recv paths in sock.h.
+//
+// Compile with `__MICRO_SOCKETS__TRACE` defined to hook the recorder into
+// _sock__send, _sock__recv and _sock__close; without it the hooks compile to
+// nothing. With the hooks compiled in but no trace running, each call costs
+// one atomic load and a predictable branch.
+//
+// Every thread doing socket I/O writes records into its own lock-free ring.
+// A background thread drains all rings into the log file, so the I/O path
+// never blocks on disk. If a ring is full the record is dropped and counted
+// (see `trace__dropped`). Traces can be started and stopped at any time on a
+// live server; ring buffers only exist while a trace is running, and the
+// ring of a thread that exits is freed once the writer has drained it.
+//
+// Needs clock_gettime(CLOCK_MONOTONIC): with a strict -std=c11, define
+// _POSIX_C_SOURCE before including any system header.
+//
+// Log format (native byte order): a `trace_file_header_t`, followed by
+// records, each a `trace_record_t` directly followed by `payload_len` bytes
+// of payload. Records of different threads are not ordered by time.
+
+#define TRACE_MAGIC "MSTRACE"
+#define TRACE_VERSION 1
+
+#define TRACE_RECV 1
+#define TRACE_SEND 2
+#define TRACE_CLOSE 3
+
+typedef struct trace_file_header_t trace_file_header_t;
+
+struct trace_file_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t payload_max;  // payload bytes kept per record, 0 for none
+};
+
+typedef struct trace_record_t trace_record_t;
+
+struct trace_record_t {
+  uint64_t ts_ns;        // CLOCK_MONOTONIC, see _trace__now_ns
+  int32_t conn;          // socket fd, reused after a TRACE_CLOSE record
+  int32_t len;           // result of send/recv, negative on error
+  uint32_t payload_len;  // bytes of payload following this record
+  uint8_t event;         // TRACE_RECV, TRACE_SEND or TRACE_CLOSE
+  uint8_t _reserved[3];
+};
+
+typedef struct trace_ring_t trace_ring_t;
+
+// One per live thread that recorded. Buffers are released when a trace
+// stops; the ring itself when its thread exits, see _trace__reap.
+struct trace_ring_t {
+  trace_ring_t* next;
+  // Owner may be touching the ring right now
+  atomic_bool busy;
+  // Owning thread exited, the ring is unlinked and freed once drained
+  atomic_bool retired;
+  // Trace the buffer is set up for, 0 for none
+  __MICRO_SOCKETS__ATOMIC(uint64_t) gen;
+  // Written by the owning thread
+  __MICRO_SOCKETS__ATOMIC(uint64_t) head;
+  // Written by the writer thread
+  __MICRO_SOCKETS__ATOMIC(uint64_t) tail;
+  size_t cap;  // power of two
+  uint8_t* data;
+};
+
+typedef struct trace_t trace_t;
+
+struct trace_t {
+  FILE* file;
+  pthread_t writer;
+  atomic_bool running;
+  size_t ring_size;
+  uint32_t payload_max;
+  uint64_t gen;
+  __MICRO_SOCKETS__ATOMIC(uint64_t) dropped;
+};
+
+#ifdef __cplusplus
+#define __MICRO_SOCKETS__THREAD_LOCAL thread_local
+#else
+#define __MICRO_SOCKETS__THREAD_LOCAL _Thread_local
+#endif
+
+// Process wide state. Weak so that every translation unit including this
+// header, C or C++, shares one definition.
+__attribute__((weak))
+__MICRO_SOCKETS__ATOMIC(trace_t*) _micro_sockets__tracer = NULL;
+__attribute__((weak))
+__MICRO_SOCKETS__ATOMIC(trace_ring_t*) _micro_sockets__trace_rings = NULL;
+__attribute__((weak))
+__MICRO_SOCKETS__ATOMIC(uint64_t) _micro_sockets__trace_gen = 0;
+__attribute__((weak)) atomic_bool _micro_sockets__trace_lock = false;
+__attribute__((weak))
+__MICRO_SOCKETS__THREAD_LOCAL trace_ring_t* _micro_sockets__trace_ring;
+__attribute__((weak)) pthread_key_t _micro_sockets__trace_key;
+__attribute__((weak))
+pthread_once_t _micro_sockets__trace_once = PTHREAD_ONCE_INIT;
+
+// Records of all threads and translation units have to share one clock, or
+// the replay order and pacing break. Refuse to build rather than fall back.
+#ifndef CLOCK_MONOTONIC
+#error "micro-sockets/trace.h needs CLOCK_MONOTONIC, define _POSIX_C_SOURCE"
+#endif
+
+__MICRO_SOCKETS__INLINE
+uint64_t _trace__now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return _M_cast(uint64_t, ts.tv_sec) * 1000000000ull +
+         _M_cast(uint64_t, ts.tv_nsec);
+}
+
+//
+//
+// ------------------------- RING -------------------------
+//
+//
+
+// Thread exit destructor of the ring key. The ring is only flagged here,
+// unlinking it has to wait until the writer is done with it.
+__MICRO_SOCKETS__INLINE
+void _trace_ring__retire(void* arg) {
+  trace_ring_t* self = _M_cast(trace_ring_t*, arg);
+
+  _micro_sockets__trace_ring = NULL;
+  atomic_store_explicit(&self->retired, true, memory_order_release);
+}
+
+__MICRO_SOCKETS__INLINE
+void _trace_ring__create_key(void) {
+  pthread_key_create(&_micro_sockets__trace_key, _trace_ring__retire);
+}
+
+// Returns the calling thread's ring, creating it on first use.
+__MICRO_SOCKETS__INLINE
+trace_ring_t* _trace_ring__get(void) {
+  trace_ring_t* self = _micro_sockets__trace_ring;
+  if (self != NULL) return self;
+
+  pthread_once(&_micro_sockets__trace_once, _trace_ring__create_key);
+
+  self = _M_new(trace_ring_t);
+  if (self == NULL) return NULL;
+
+  if (pthread_setspecific(_micro_sockets__trace_key, self) != 0) {
+    _M_free(self);
+    return NULL;
+  }
+
+  atomic_init(&self->busy, false);
+  atomic_init(&self->retired, false);
+  atomic_init(&self->gen, 0);
+  atomic_init(&self->head, 0);
+  atomic_init(&self->tail, 0);
+  self->cap = 0;
+  self->data = NULL;
+
+  self->next = atomic_load(&_micro_sockets__trace_rings);
+  while (!atomic_compare_exchange_weak(&_micro_sockets__trace_rings,
+                                       &self->next, self)) {
+  }
+
+  _micro_sockets__trace_ring = self;
+  return self;
+}
+
+// Owner only, while busy. Prepares the buffer for `trace`.
+__MICRO_SOCKETS__INLINE
+bool _trace_ring__setup(trace_ring_t* self, const trace_t* trace) {
+  if (self->cap != trace->ring_size) {
+    _M_free(self->data);
+    self->data = _M_cast(uint8_t*, _M_alloc(trace->ring_size));
+    self->cap = self->data == NULL ? 0 : trace->ring_size;
+    if (self->data == NULL) return false;
+  }
+
+  atomic_store_explicit(&self->head, 0, memory_order_relaxed);
+  atomic_store_explicit(&self->tail, 0, memory_order_relaxed);
+  atomic_store_explicit(&self->gen, trace->gen, memory_order_release);
+
+  return true;
+}
+
+__MICRO_SOCKETS__INLINE
+void _trace_ring__copy_in(trace_ring_t* self, uint64_t pos, const void* src,
+                          size_t size) {
+  size_t off = _M_cast(size_t, pos & (self->cap - 1));
+  size_t first = size < self->cap - off ? size : self->cap - off;
+
+  memcpy(self->data + off, src, first);
+  memcpy(self->data, _M_cast(const uint8_t*, src) + first, size - first);
+}
+
+// Writes everything the owning thread published so far to `file`.
+__MICRO_SOCKETS__INLINE
+void _trace_ring__drain(trace_ring_t* self, FILE* file) {
+  uint64_t head = atomic_load_explicit(&self->head, memory_order_acquire);
+  uint64_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+  if (head == tail) return;
+
+  size_t size = _M_cast(size_t, head - tail);
+  size_t off = _M_cast(size_t, tail & (self->cap - 1));
+  size_t first = size < self->cap - off ? size : self->cap - off;
+
+  fwrite(self->data + off, 1, first, file);
+  fwrite(self->data, 1, size - first, file);
+
+  atomic_store_explicit(&self->tail, head, memory_order_release);
+}
+
+//
+//
+// ------------------------- TRACE -------------------------
+//
+//
+
+// Start and stop are rare, they are serialized with a simple spin lock.
+__MICRO_SOCKETS__INLINE
+void _trace__lock(void) {
+  while (atomic_exchange(&_micro_sockets__trace_lock, true)) {
+    poll(NULL, 0, 1);
+  }
+}
+
+__MICRO_SOCKETS__INLINE
+void _trace__unlock(void) {
+  atomic_store(&_micro_sockets__trace_lock, false);
+}
+
+__MICRO_SOCKETS__INLINE
+void _trace__drain_all(trace_t* self) {
+  trace_ring_t* ring = atomic_load(&_micro_sockets__trace_rings);
+
+  for (; ring != NULL; ring = ring->next) {
+    uint64_t gen = atomic_load_explicit(&ring->gen, memory_order_acquire);
+    if (gen == self->gen) _trace_ring__drain(ring, self->file);
+  }
+}
+
+// Lock held, and nobody else walking the ring list: the writer reaping
+// itself, or no writer running. Drains rings of exited threads into the
+// running trace `self` (NULL for none), then unlinks and frees them. Rings
+// are only ever pushed in front, so unlinking the head races with pushes
+// and everything else does not.
+__MICRO_SOCKETS__INLINE
+void _trace__reap(trace_t* self) {
+  trace_ring_t* prev = NULL;
+  trace_ring_t* ring = atomic_load(&_micro_sockets__trace_rings);
+
+  while (ring != NULL) {
+    trace_ring_t* next = ring->next;
+    if (!atomic_load_explicit(&ring->retired, memory_order_acquire)) {
+      prev = ring;
+      ring = next;
+      continue;
+    }
+
+    uint64_t gen = atomic_load_explicit(&ring->gen, memory_order_acquire);
+    if (self != NULL && gen == self->gen) _trace_ring__drain(ring, self->file);
+
+    trace_ring_t* head = ring;
+    if (prev != NULL) {
+      prev->next = next;
+    } else if (!atomic_compare_exchange_strong(&_micro_sockets__trace_rings,
+                                               &head, next)) {
+      // New rings were pushed in front meanwhile, `head` is the new first
+      for (prev = head; prev->next != ring; prev = prev->next) {
+      }
+      prev->next = next;
+    }
+
+    _M_free(ring->data);
+    _M_free(ring);
+    ring = next;
+  }
+}
+
+__MICRO_SOCKETS__INLINE
+void* _trace__writer(void* arg) {
+  trace_t* self = _M_cast(trace_t*, arg);
+
+  while (atomic_load(&self->running)) {
+    _trace__drain_all(self);
+
+    // Skip reaping while start/stop hold the lock, trace__stop waits for
+    // this thread with the lock held
+    if (!atomic_exchange(&_micro_sockets__trace_lock, true)) {
+      _trace__reap(self);
+      _trace__unlock();
+    }
+
+    poll(NULL, 0, 1);
+  }
+
+  _trace__drain_all(self);
+  return NULL;
+}
+
+// Starts recording to `path`. `ring_size` is the per-thread buffer in bytes
+// (rounded up to a power of two), `payload_max` how many payload bytes to
+// keep per record (0 records sizes only). Returns -1 if a trace is already
+// running, the file cannot be opened, or a ring could not hold a single
+// record with full payload.
+__MICRO_SOCKETS__INLINE
+int32_t trace__start(const char* path, size_t ring_size, uint32_t payload_max) {
+  size_t cap = 4096;
+  while (cap < ring_size) cap <<= 1;
+  if (cap < sizeof(trace_record_t) + payload_max) return -1;
+
+  _trace__lock();
+  if (atomic_load(&_micro_sockets__tracer) != NULL) {
+    _trace__unlock();
+    return -1;
+  }
+
+  // Threads that exited since the last trace
+  _trace__reap(NULL);
+
+  trace_t* self = _M_new(trace_t);
+  if (self == NULL) {
+    _trace__unlock();
+    return -1;
+  }
+
+  self->file = fopen(path, "wb");
+  if (self->file == NULL) {
+    _M_free(self);
+    _trace__unlock();
+    return -1;
+  }
+
+  trace_file_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version = TRACE_VERSION;
+  header.payload_max = payload_max;
+  fwrite(&header, sizeof(header), 1, self->file);
+
+  atomic_init(&self->running, true);
+  atomic_init(&self->dropped, 0);
+  self->ring_size = cap;
+  self->payload_max = payload_max;
+  self->gen = atomic_fetch_add(&_micro_sockets__trace_gen, 1) + 1;
+
+  if (pthread_create(&self->writer, NULL, _trace__writer, self) != 0) {
+    fclose(self->file);
+    _M_free(self);
+    _trace__unlock();
+    return -1;
+  }
+
+  atomic_store(&_micro_sockets__tracer, self);
+  _trace__unlock();
+
+  return 0;
+}
+
+// Number of records dropped because a ring was full, for the running trace.
+__MICRO_SOCKETS__INLINE
+uint64_t trace__dropped(void) {
+  _trace__lock();
+  trace_t* self = atomic_load(&_micro_sockets__tracer);
+  uint64_t dropped = self == NULL ? 0 : atomic_load(&self->dropped);
+  _trace__unlock();
+
+  return dropped;
+}
+
+// Stops recording, flushes all rings and closes the log. Safe to call while
+// other threads keep doing socket I/O: it waits until none of them is still
+// writing into a ring before releasing the buffers.
+__MICRO_SOCKETS__INLINE
+void trace__stop(void) {
+  _trace__lock();
+
+  trace_t* self = atomic_exchange(&_micro_sockets__tracer, NULL);
+  if (self == NULL) {
+    _trace__unlock();
+    return;
+  }
+
+  // A thread that raised `busy` before the exchange may still use `self`,
+  // any later one sees NULL and backs off without touching its ring
+  trace_ring_t* rings = atomic_load(&_micro_sockets__trace_rings);
+  for (trace_ring_t* ring = rings; ring != NULL; ring = ring->next) {
+    while (atomic_load(&ring->busy)) {
+    }
+  }
+
+  atomic_store(&self->running, false);
+  pthread_join(self->writer, NULL);
+  _trace__reap(self);
+  fclose(self->file);
+
+  rings = atomic_load(&_micro_sockets__trace_rings);
+  for (trace_ring_t* ring = rings; ring != NULL; ring = ring->next) {
+    atomic_store(&ring->gen, 0);
+    _M_free(ring->data);
+    ring->data = NULL;
+    ring->cap = 0;
+  }
+
+  _M_free(self);
+  _trace__unlock();
+}
+
+__MICRO_SOCKETS__INLINE
+void _trace__write(uint8_t event, int32_t conn, const uint8_t* ptr,
+                   ssize_t len) {
+  trace_ring_t* ring = _trace_ring__get();
+  if (ring == NULL) return;
+
+  // Announce the access before looking at the tracer again, trace__stop
+  // does the reverse (clear the tracer, then wait for `busy`)
+  atomic_store(&ring->busy, true);
+  trace_t* self = atomic_load(&_micro_sockets__tracer);
+
+  if (self == NULL) {
+    atomic_store_explicit(&ring->busy, false, memory_order_release);
+    return;
+  }
+
+  uint64_t gen = atomic_load_explicit(&ring->gen, memory_order_relaxed);
+  if (gen != self->gen && !_trace_ring__setup(ring, self)) {
+    atomic_store_explicit(&ring->busy, false, memory_order_release);
+    return;
+  }
+
+  size_t payload = 0;
+  if (ptr != NULL && len > 0) {
+    payload = _M_cast(size_t, len) < self->payload_max
+                  ? _M_cast(size_t, len)
+                  : self->payload_max;
+  }
+
+  trace_record_t rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.ts_ns = _trace__now_ns();
+  rec.conn = conn;
+  rec.len = _M_cast(int32_t, len);
+  rec.payload_len = _M_cast(uint32_t, payload);
+  rec.event = event;
+  size_t need = sizeof(rec) + payload;
+
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  if (ring->cap - _M_cast(size_t, head - tail) < need) {
+    atomic_fetch_add_explicit(&self->dropped, 1, memory_order_relaxed);
+  } else {
+    _trace_ring__copy_in(ring, head, &rec, sizeof(rec));
+    if (payload > 0) {
+      _trace_ring__copy_in(ring, head + sizeof(rec), ptr, payload);
+    }
+    atomic_store_explicit(&ring->head, head + need, memory_order_release);
+  }
+
+  atomic_store_explicit(&ring->busy, false, memory_order_release);
+}
+
+// Records one event if a trace is running. Called by the sock.h hooks.
+__MICRO_SOCKETS__INLINE
+void trace__record(uint8_t event, int32_t conn, const uint8_t* ptr,
+                   ssize_t len) {
+  trace_t* self =
+      atomic_load_explicit(&_micro_sockets__tracer, memory_order_relaxed);
+  if (__builtin_expect(self == NULL, 1)) return;
+
+  _trace__write(event, conn, ptr, len);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __MICRO_SOCKETS__TRACE__H
@@ -0,0 +1,276 @@
+/******************************************************************************/
+/* micro-sockets - A lightweight, header-only C library for simplified        */
+/* network socket programming.                                                */
+/* Copyright (C) 2024, Hendrik Boeck <hendrikboeck.dev@protonmail.com>        */
+/*                                                                            */
+/* This program is free software: you can redistribute it and/or modify  it   */
+/* under the terms of the GNU General Public License as published by the Free */
+/* Software Foundation, either version 3 of the License, or (at your option)  */
+/* any later version.                                                         */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful, but        */
+/* WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY */
+/* or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License   */
+/* for more details.                                                          */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License along    */
+/* with this program.  If not, see <https://www.gnu.org/licenses/>.           */
+/******************************************************************************/
+
+#ifndef __MICRO_SOCKETS__ZEROCOPY__H
+#define __MICRO_SOCKETS__ZEROCOPY__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+
+// Pin to the top of file, becuase it is used in the definitions of include
+// macros like __MICRO_SOCKETS__IS_WINDOWS, DO NOT MOVE THIS INCLUDE !!!
+#include "micro-sockets/_defs.h"
+
+// clang-format on
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "ccms/_macros.h"
+#include "ccms/box.h"
+#include "micro-sockets/buf.h"
+#include "micro-sockets/sock.h"
+#include "micro-sockets/tcp.h"
+
+// Zero-copy receive for bulk transfers (Linux >= 4.18).
+//
+// The socket is mmap'ed once and TCP_ZEROCOPY_RECEIVE maps page aligned
+// payload straight into that window instead of copying it. Whatever the
+// kernel cannot map (the unaligned remainder, reported as skip hint) is read
+// with a regular recv into the attached buf_t. Callers just get box_t views
+// and do not need to care which path produced them.
+//
+// A mapped view stays valid until `tcp_zc_recv__release` or the next call to
+// `tcp_zc_recv__recv`, which hands the pages back to the kernel. A copied
+// view points into the buf_t and is overwritten by the next copy. On other
+// platforms, or if the kernel rejects the option, every receive is a copy.
+//
+// When the kernel keeps mapping nothing, e.g. over loopback, the receiver
+// backs off and copies for a growing number of receives before it probes
+// again, so such links do not pay an extra getsockopt per chunk.
+
+#if defined(__linux__)
+#define __MICRO_SOCKETS__HAS_ZEROCOPY 1
+
+#ifndef TCP_ZEROCOPY_RECEIVE
+#define TCP_ZEROCOPY_RECEIVE 35
+#endif
+
+// First revision of `struct tcp_zerocopy_receive`. Declared here since the
+// libc version is hidden behind feature macros and newer kernels accept the
+// short layout.
+typedef struct _tcp_zc_args_t _tcp_zc_args_t;
+
+struct _tcp_zc_args_t {
+  uint64_t address;
+  uint32_t length;
+  uint32_t recv_skip_hint;
+};
+#else
+#define __MICRO_SOCKETS__HAS_ZEROCOPY 0
+#endif
+
+// Probes in a row that map nothing before backing off, and the range of
+// copies made before the next probe
+#define _TCP_ZC_MAX_MISSES 4
+#define _TCP_ZC_MIN_BACKOFF 64
+#define _TCP_ZC_MAX_BACKOFF 4096
+
+typedef struct tcp_zc_recv_t tcp_zc_recv_t;
+
+struct tcp_zc_recv_t {
+  sock_t fd;
+  buf_t* buf;
+  uint8_t* map;
+  size_t map_size;
+  size_t skip;      // bytes that have to be copied before mapping again
+  int32_t enabled;  // 0 once the kernel refused zero-copy
+  uint32_t misses;   // probes in a row that mapped nothing
+  uint32_t backoff;  // copies per back-off, doubles while probes keep missing
+  uint32_t copies;   // copies left before the next probe
+  size_t mapped_bytes;
+  size_t copied_bytes;
+};
+
+__MICRO_SOCKETS__INLINE
+void tcp_zc_recv__free(tcp_zc_recv_t* self) {
+#if __MICRO_SOCKETS__HAS_ZEROCOPY
+  if (self->map != NULL) munmap(self->map, self->map_size);
+#endif
+  if (self->buf != NULL) buf__free(self->buf);
+  _M_free(self);
+}
+
+// Creates a zero-copy receiver on the connected socket `fd` with a mapping
+// window of `map_size` bytes (rounded up to whole pages). `buf` takes the
+// copied remainder, the receiver owns it afterwards. The socket itself is
+// not owned and has to be closed separately.
+__MICRO_SOCKETS__INLINE
+tcp_zc_recv_t* tcp_zc_recv__new(sock_t fd, size_t map_size, buf_t* buf) {
+  tcp_zc_recv_t* self = _M_new(tcp_zc_recv_t);
+  if (self == NULL) return NULL;
+
+  self->fd = fd;
+  self->buf = buf;
+  self->map = NULL;
+  self->map_size = 0;
+  self->skip = 0;
+  self->enabled = 0;
+  self->misses = 0;
+  self->backoff = 0;
+  self->copies = 0;
+  self->mapped_bytes = 0;
+  self->copied_bytes = 0;
+
+#if __MICRO_SOCKETS__HAS_ZEROCOPY
+  size_t page = _M_cast(size_t, sysconf(_SC_PAGESIZE));
+  map_size = (map_size + page - 1) / page * page;
+
+  void* map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map != MAP_FAILED) {
+    self->map = _M_cast(uint8_t*, map);
+    self->map_size = map_size;
+    self->enabled = 1;
+  }
+#else
+  (void)map_size;
+#endif
+
+  return self;
+}
+
+__MICRO_SOCKETS__INLINE
+tcp_zc_recv_t* tcp_connection__zc_recv(tcp_connection_t* conn,
+                                       size_t map_size, buf_t* buf) {
+  return tcp_zc_recv__new(conn->fd, map_size, buf);
+}
+
+// Returns mapped pages of a view from `tcp_zc_recv__recv` to the kernel
+// before the next receive would. No-op for copied views.
+__MICRO_SOCKETS__INLINE
+void tcp_zc_recv__release(tcp_zc_recv_t* self, box_t view) {
+#if __MICRO_SOCKETS__HAS_ZEROCOPY && defined(MADV_DONTNEED)
+  if (view.ptr != NULL && view.ptr >= self->map &&
+      view.ptr < self->map + self->map_size) {
+    madvise(view.ptr, view.size, MADV_DONTNEED);
+  }
+#else
+  (void)self;
+  (void)view;
+#endif
+}
+
+#if __MICRO_SOCKETS__HAS_ZEROCOPY
+// Tries to map received payload into the window. Returns the mapped view
+// (size 0 if nothing could be mapped) and updates the copy remainder.
+__MICRO_SOCKETS__INLINE
+box_t _tcp_zc_recv__map(tcp_zc_recv_t* self) {
+  _tcp_zc_args_t zc;
+  zc.address = _M_cast(uint64_t, _M_cast(uintptr_t, self->map));
+  zc.length = _M_cast(uint32_t, self->map_size);
+  zc.recv_skip_hint = 0;
+  socklen_t len = sizeof(zc);
+
+  if (getsockopt(self->fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc, &len) != 0) {
+    // Not supported by this kernel/socket, use plain recv from now on
+    if (errno == ENOPROTOOPT || errno == EINVAL || errno == EOPNOTSUPP ||
+        errno == ENODEV) {
+      self->enabled = 0;
+    }
+    return box__ctor(NULL, 0);
+  }
+
+  self->skip = zc.recv_skip_hint;
+  self->mapped_bytes += zc.length;
+  if (zc.length > 0) {
+    _sock__trace(TRACE_RECV, self->fd, self->map, _M_cast(ssize_t, zc.length));
+  }
+
+  return box__ctor(self->map, zc.length);
+}
+
+// Called when data was waiting but none of it could be mapped. After a few
+// misses in a row, stops probing for `backoff` copies, and doubles that each
+// time probing resumes and still misses.
+__MICRO_SOCKETS__INLINE
+void _tcp_zc_recv__miss(tcp_zc_recv_t* self) {
+  if (++self->misses < _TCP_ZC_MAX_MISSES) return;
+
+  self->misses = 0;
+  self->backoff = self->backoff == 0 ? _TCP_ZC_MIN_BACKOFF : self->backoff * 2;
+  if (self->backoff > _TCP_ZC_MAX_BACKOFF) self->backoff = _TCP_ZC_MAX_BACKOFF;
+  self->copies = self->backoff;
+  self->skip = 0;  // copy whole buffers while backing off
+}
+#endif
+
+// Receives the next chunk of data. Blocks like `tcp_connection__recv` and,
+// like it, returns a view of size 0 on EOF and `ptr == NULL` on error.
+__MICRO_SOCKETS__INLINE
+box_t tcp_zc_recv__recv(tcp_zc_recv_t* self) {
+#if __MICRO_SOCKETS__HAS_ZEROCOPY
+  // Data already in the receive queue is mapped right away. If there is none
+  // yet, wait once and try again before falling back to a (blocking) copy.
+  bool probe = self->enabled && self->skip == 0 && self->copies == 0;
+  if (self->copies > 0) self->copies--;
+
+  for (int32_t attempt = 0; probe && attempt < 2; attempt++) {
+    box_t mapped = _tcp_zc_recv__map(self);
+    if (mapped.size > 0) {
+      self->misses = 0;
+      self->backoff = 0;
+      return mapped;
+    }
+    if (self->skip > 0) {
+      _tcp_zc_recv__miss(self);
+      break;
+    }
+    if (attempt > 0) break;
+
+    struct pollfd pfd;
+    pfd.fd = self->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, -1) < 0) break;
+  }
+#endif
+
+  // Copy path: the unaligned remainder, or everything without zero-copy
+  buf_t window = *self->buf;
+  if (self->skip > 0 && self->skip < window.size) window.size = self->skip;
+
+  ssize_t len = _sock__recv(self->fd, &window);
+  if (len < 0) return box__ctor(NULL, 0);
+
+  size_t size = _M_cast(size_t, len);
+  self->skip = size < self->skip ? self->skip - size : 0;
+  self->copied_bytes += size;
+  self->buf->len = size;
+
+  return box__ctor(self->buf->ptr, size);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __MICRO_SOCKETS__ZEROCOPY__H
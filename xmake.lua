@@ -28,3 +28,50 @@ target("examples/tcp_server")
   set_kind("binary")
   add_files("examples/tcp_server.c")
   add_deps("micro-sockets")
+
+target("examples/scan_bench")
+  set_enabled(true)
+  set_kind("binary")
+  add_files("examples/scan_bench.c")
+  add_deps("micro-sockets")
+
+target("examples/tcp_echo_server")
+  set_enabled(true)
+  set_kind("binary")
+  add_files("examples/tcp_echo_server.c")
+  add_deps("micro-sockets")
+  add_defines("__MICRO_SOCKETS__TRACE")
+  add_syslinks("pthread")
+
+target("examples/tcp_proxy")
+  set_enabled(true)
+  set_kind("binary")
+  add_files("examples/tcp_proxy.c")
+  add_deps("micro-sockets")
+
+target("examples/tcp_loadgen")
+  set_enabled(true)
+  set_kind("binary")
+  add_files("examples/tcp_loadgen.c")
+  add_deps("micro-sockets")
+  add_syslinks("pthread")
+
+target("examples/tcp_broadcast_server")
+  set_enabled(true)
+  set_kind("binary")
+  add_files("examples/tcp_broadcast_server.c")
+  add_deps("micro-sockets")
+  add_syslinks("pthread")
+
+target("examples/tcp_bulk_ingest")
+  set_enabled(true)
+  set_kind("binary")
+  add_files("examples/tcp_bulk_ingest.c")
+  add_deps("micro-sockets")
+
+target("examples/tcp_replay")
+  set_enabled(true)
+  set_kind("binary")
+  add_files("examples/tcp_replay.c")
+  add_deps("micro-sockets")
+  add_syslinks("pthread")